@@ -1,18 +1,49 @@
 #ifndef ALLOC_H
 #define ALLOC_H
 
-
 #include <new>
+#include <cstddef>
 #include <stdlib.h>
 #include <mutex>
 #include <cstring>
+#include <stdint.h>
+#include <algorithm>
+#include <type_traits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <stdio.h>
+#include <malloc.h>
+
+//  C++17起可以把配置器包装成std::pmr::memory_resource
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define __ALLOC_HAS_PMR 1
+#endif
+#endif
+
+//  定义ALLOC_PERCPU_CACHE之后，二级配置器在线程缓存前面加一层每个CPU一份的缓存，
+//  用Linux的restartable sequences(rseq)实现无锁的压入和弹出，需要x86-64和glibc 2.35以上
+//  运行时rseq没有注册时退回线程缓存
+#if defined(ALLOC_PERCPU_CACHE) && defined(__x86_64__) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#include <sched.h>
+#define __ALLOC_HAS_RSEQ 1
+#endif
+#endif
 
 //   定义一个名为 HandlerFunc 的函数指针类型
 //   该函数指针指向一个无回返值(void)、无参数列表的函数
 typedef void(*HandlerFunc)();
 
+//  内存回收函数：尽量释放__want字节(0表示能释放多少就释放多少)，返回实际释放的字节数
+typedef size_t(*ReclaimFunc)(size_t);
+
 //  一级配置器
-template <int inst>
 class __malloc_alloc_template
 {
 private:
@@ -20,10 +51,77 @@ private:
     static void *oom_malloc(size_t);
     //  重新分配内存失败时调用的函数，尝试释放一部分
     static void *oom_realloc(void *, size_t);
+    //  按对齐分配内存失败时调用的函数
+    static void *oom_memalign(size_t, size_t);
+    //  申请清零的内存失败时调用的函数
+    static void *oom_calloc(size_t);
     //  在程序运行时，当内存申请失败时所调用的回调函数，用于处理内存不足的情况
+    //  所有回收函数都释放不出内存时才会调用
     static HandlerFunc _handler;
 
+    //  回收函数表，按优先级从小到大排列，由_reclaim_mtx保护
+    enum { __MAX_RECLAIMERS = 16 };
+    struct _Reclaimer
+    {
+        ReclaimFunc _M_func;
+        int _M_priority;
+        const char* _M_name;
+        size_t _M_calls;
+        size_t _M_freed;
+    };
+    static _Reclaimer _reclaimers[__MAX_RECLAIMERS];
+    static size_t _reclaimer_count;
+    static std::mutex _reclaim_mtx;
+    //  本线程正在执行回收函数，回收函数中再次内存不足时不能重入
+    static thread_local bool _reclaiming;
+
+    //  驻留内存(RSS)的上限，0表示不检查；新申请的内存每累计__PRESSURE_STEP字节读取一次RSS
+    enum { __PRESSURE_STEP = 4 * 1024 * 1024 };
+    static size_t _rss_limit;
+    static size_t _growth;
+
+    //  统计计数，一级配置器处理的都是大块内存，每次都要调用malloc，
+    //  相比之下一次relaxed的原子加法可以忽略不计
+    static size_t _allocations;
+    static size_t _frees;
+    static size_t _reallocations;
+    static size_t _bytes_requested;
+    static size_t _oom_calls;
+    static size_t _pressure_events;
+
+    static void _count(size_t& __counter, size_t __n = 1)
+    {
+        __atomic_fetch_add(&__counter, __n, __ATOMIC_RELAXED);
+    }
+
 public:
+    //  一级配置器的统计信息
+    struct malloc_stats
+    {
+        //  allocate/deallocate/reallocate被调用的次数
+        size_t allocations;
+        size_t frees;
+        size_t reallocations;
+        //  allocate和reallocate请求的总字节数
+        size_t bytes_requested;
+        //  内存不足、进行回收的次数
+        size_t oom_calls;
+        //  RSS超过上限、进行回收的次数
+        size_t pressure_events;
+    };
+
+    //  读取统计信息
+    static malloc_stats stats()
+    {
+        malloc_stats __s;
+        __s.allocations = __atomic_load_n(&_allocations, __ATOMIC_RELAXED);
+        __s.frees = __atomic_load_n(&_frees, __ATOMIC_RELAXED);
+        __s.reallocations = __atomic_load_n(&_reallocations, __ATOMIC_RELAXED);
+        __s.bytes_requested = __atomic_load_n(&_bytes_requested, __ATOMIC_RELAXED);
+        __s.oom_calls = __atomic_load_n(&_oom_calls, __ATOMIC_RELAXED);
+        __s.pressure_events = __atomic_load_n(&_pressure_events, __ATOMIC_RELAXED);
+        return __s;
+    }
 
     //  设置内存不足时的处理函数，返回原来的处理函数
     static HandlerFunc set_malloc_handler(HandlerFunc f)
@@ -33,21 +131,236 @@ public:
         return (old);
     }
 
+    //  注册一个回收函数，内存不足或者RSS超过上限时按__priority从小到大依次调用，
+    //  优先级相同的按注册顺序；二级配置器的trim以优先级0注册，负的优先级在它之前调用
+    //  表满时返回false
+    static bool add_reclaimer(ReclaimFunc __func, int __priority, const char* __name)
+    {
+        std::lock_guard<std::mutex> guard(_reclaim_mtx);
+        if (_reclaimer_count == (size_t)__MAX_RECLAIMERS)
+        {
+            return false;
+        }
+        size_t __i = _reclaimer_count++;
+        for (; __i > 0 && _reclaimers[__i - 1]._M_priority > __priority; __i--)
+        {
+            _reclaimers[__i] = _reclaimers[__i - 1];
+        }
+        _reclaimers[__i]._M_func = __func;
+        _reclaimers[__i]._M_priority = __priority;
+        _reclaimers[__i]._M_name = __name;
+        _reclaimers[__i]._M_calls = 0;
+        _reclaimers[__i]._M_freed = 0;
+        return true;
+    }
+
+    //  注销一个回收函数，没有注册过时返回false
+    static bool remove_reclaimer(ReclaimFunc __func)
+    {
+        std::lock_guard<std::mutex> guard(_reclaim_mtx);
+        for (size_t __i = 0; __i < _reclaimer_count; __i++)
+        {
+            if (_reclaimers[__i]._M_func == __func)
+            {
+                for (; __i + 1 < _reclaimer_count; __i++)
+                {
+                    _reclaimers[__i] = _reclaimers[__i + 1];
+                }
+                _reclaimer_count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //  一个回收函数的统计信息
+    struct reclaimer_info
+    {
+        const char* name;
+        int priority;
+        //  被调用的次数和累计释放的字节数
+        size_t calls;
+        size_t bytes_freed;
+    };
+
+    //  按调用顺序把回收函数的信息写入__out，最多__max个，返回回收函数的个数
+    static size_t reclaimers(reclaimer_info* __out, size_t __max)
+    {
+        std::lock_guard<std::mutex> guard(_reclaim_mtx);
+        for (size_t __i = 0; __i < _reclaimer_count && __i < __max; __i++)
+        {
+            __out[__i].name = _reclaimers[__i]._M_name;
+            __out[__i].priority = _reclaimers[__i]._M_priority;
+            __out[__i].calls = _reclaimers[__i]._M_calls;
+            __out[__i].bytes_freed = _reclaimers[__i]._M_freed;
+        }
+        return _reclaimer_count;
+    }
+
+    //  按优先级依次调用回收函数，累计释放了__want字节(0表示全部调用)后停止，返回释放的字节数
+    //  回收函数中再次内存不足时不会重入，直接返回0
+    static size_t reclaim(size_t __want = 0)
+    {
+        if (_reclaiming)
+        {
+            return 0;
+        }
+        std::lock_guard<std::mutex> guard(_reclaim_mtx);
+        _reclaiming = true;
+        size_t __freed = 0;
+        try
+        {
+            for (size_t __i = 0; __i < _reclaimer_count; __i++)
+            {
+                size_t __got = _reclaimers[__i]._M_func(__want == 0 ? 0 : __want - __freed);
+                _reclaimers[__i]._M_calls++;
+                _reclaimers[__i]._M_freed += __got;
+                __freed += __got;
+                if (__want != 0 && __freed >= __want)
+                {
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            _reclaiming = false;
+            throw;
+        }
+        _reclaiming = false;
+        return __freed;
+    }
+
+    //  fork前后由__default_alloc_base::lock_all/unlock_all调用，回收函数表的锁最先获取
+    static void lock()
+    {
+        _reclaim_mtx.lock();
+    }
+
+    static void unlock()
+    {
+        _reclaim_mtx.unlock();
+    }
+
+    //  设置RSS上限，超过时调用回收函数把RSS降到上限以下，0表示不检查
+    static void set_rss_limit(size_t __bytes)
+    {
+        __atomic_store_n(&_rss_limit, __bytes, __ATOMIC_RELAXED);
+    }
+
+    //  当前进程的驻留内存字节数，读取/proc/self/statm，不会分配内存
+    static size_t rss()
+    {
+        char __buf[128];
+        int __fd = open("/proc/self/statm", O_RDONLY);
+        if (__fd < 0)
+        {
+            return 0;
+        }
+        ssize_t __len = read(__fd, __buf, sizeof(__buf) - 1);
+        close(__fd);
+        if (__len <= 0)
+        {
+            return 0;
+        }
+        __buf[__len] = 0;
+        //  第二个字段是驻留的页数
+        char* __c = __buf;
+        while (*__c != 0 && *__c != ' ')
+        {
+            __c++;
+        }
+        return (size_t)strtoull(__c, 0, 10) * (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    //  向系统新申请了__bytes字节后调用，调用者不能持有任何配置器的锁
+    //  设置了RSS上限时，每累计__PRESSURE_STEP字节检查一次RSS，超过上限就回收
+    static void note_growth(size_t __bytes)
+    {
+        size_t __limit = __atomic_load_n(&_rss_limit, __ATOMIC_RELAXED);
+        if (__limit == 0
+            || __atomic_add_fetch(&_growth, __bytes, __ATOMIC_RELAXED) < (size_t)__PRESSURE_STEP)
+        {
+            return;
+        }
+        __atomic_store_n(&_growth, 0, __ATOMIC_RELAXED);
+        size_t __rss = rss();
+        if (__rss > __limit)
+        {
+            _count(_pressure_events);
+            reclaim(__rss - __limit);
+        }
+    }
+
+    //  申请内存失败时调用，调用者不能持有任何配置器的锁，返回后重试申请
+    //  先按优先级调用回收函数，它们释放不出内存时调用set_malloc_handler设置的处理函数，
+    //  也没有设置处理函数时抛出bad_alloc
+    static void handle_oom(size_t __want)
+    {
+        _count(_oom_calls);
+        if (reclaim(__want) != 0)
+        {
+            return;
+        }
+        if (_handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        _handler();
+    }
+
     //  申请内存的函数
     static void * allocate(size_t size)
     {
+        _count(_allocations);
+        _count(_bytes_requested, size);
         //  直接申请内存，如果申请失败则调用 oom_malloc 函数
         void *ret = malloc(size);
         if (ret == 0)
         {
             ret = oom_malloc(size);
         }
+        note_growth(size);
+        return ret;
+    }
+
+    //  申请内容全为0的内存，用deallocate释放
+    //  calloc知道哪些内存是刚从系统映射的、本来就是0，这部分不会再写一遍
+    static void * allocate_zeroed(size_t size)
+    {
+        _count(_allocations);
+        _count(_bytes_requested, size);
+        void *ret = calloc(1, size);
+        if (ret == 0)
+        {
+            ret = oom_calloc(size);
+        }
+        note_growth(size);
+        return ret;
+    }
+
+    //  按align字节对齐申请内存，align是2的幂，用deallocate释放
+    static void * allocate_aligned(size_t size, size_t align)
+    {
+        _count(_allocations);
+        _count(_bytes_requested, size);
+        void *ret;
+        if (align < sizeof(void*))
+        {
+            align = sizeof(void*);
+        }
+        if (posix_memalign(&ret, align, size) != 0)
+        {
+            ret = oom_memalign(size, align);
+        }
+        note_growth(size);
         return ret;
     }
 
     //  释放内存的函数
     static void deallocate(void *p)
     {
+        _count(_frees);
         //  直接释放内存，对free的封装
         free(p);
     }
@@ -55,30 +368,32 @@ public:
     //  重新分配内存的函数
     static void * reallocate(void *p, size_t size_sz)
     {
-        //  对realloc的简单封装
+        _count(_reallocations);
+        _count(_bytes_requested, size_sz);
+        //  大小为0时realloc释放p并返回0，p不能再交给oom_realloc重试
+        if (size_sz == 0)
+        {
+            free(p);
+            return 0;
+        }
+        //  对realloc的简单封装，返回0时p仍然有效
         void *ret = realloc(p, size_sz);
         if (ret == 0)
         {
             ret = oom_realloc(p, size_sz);
         }
+        note_growth(size_sz);
         return ret;
     }
 
 };
 
-template <int inst>
-//  分配失败时调用的函数，不断尝试申请内存并释放一部分已有内存，直到申请成功或者失败
-void* __malloc_alloc_template<inst>::oom_malloc(size_t size)
+//  分配失败时调用的函数，不断回收一部分已有内存并重新申请，直到申请成功或者无法回收时抛出异常
+void* __malloc_alloc_template::oom_malloc(size_t size)
 {
     while(1)
     {
-        //  如果没有设置处理函数，则抛出 bad_alloc 异常
-        if (_handler == nullptr)
-        {
-            throw std::bad_alloc();
-        }
-        //  调用处理函数释放一部分内存
-        _handler();
+        handle_oom(size);
 
         //  申请内存
         void *ret = malloc(size);
@@ -90,343 +405,4150 @@ void* __malloc_alloc_template<inst>::oom_malloc(size_t size)
     }
 }
 
-template <int inst>
-//  重新分配内存失败时调用的函数，不断尝试申请内存并释放一部分已有内存，直到申请成功或者失败
-void *__malloc_alloc_template<inst>::oom_realloc(void *p, size_t n)
+//  按对齐分配失败时调用的函数，与oom_malloc相同
+void* __malloc_alloc_template::oom_memalign(size_t size, size_t align)
 {
-    if (_handler == nullptr)
+    while(1)
     {
-        throw std::bad_alloc();
+        handle_oom(size);
+
+        void *ret;
+        if (posix_memalign(&ret, align, size) == 0)
+        {
+            return ret;
+        }
     }
-    _handler();
+}
 
-    //  重新分配内存
-    void *ret = realloc(p, n);
-    //  如果申请到了，返回申请到的内存地址
-    if (ret)
+//  申请清零的内存失败时调用的函数，与oom_malloc相同
+void* __malloc_alloc_template::oom_calloc(size_t size)
+{
+    while(1)
     {
-        return (ret);
+        handle_oom(size);
+
+        void *ret = calloc(1, size);
+        if (ret)
+        {
+            return ret;
+        }
     }
 }
 
-template <int inst>
-HandlerFunc __malloc_alloc_template<inst>::_handler = nullptr;
-
-template<typename T>
-class __default_alloc_template
+//  重新分配内存失败时调用的函数，与oom_malloc相同，失败时原来的内存保持不变
+void *__malloc_alloc_template::oom_realloc(void *p, size_t n)
 {
-private:
-    //  自由链表是从8字节开始，以8字节为对齐方式，一直扩充到128
-    enum { __ALIGN = 8 };
-    //  自由链表的最大结点
-    enum { __MAX_BYTES = 128 };
-    //  自由链表的个数 = __MAX_BYTES / __ALIGN
-    enum { __NFREELISTS = 16 };
-
-    //  自由链表的节点类型
-    union _Obj
+    while(1)
     {
-        //  存储下一个节点的地址
-        union  _Obj* _M_free_list_link;
-        //  存放用户的数据
-        char _M_client_data[1];
-    };
+        handle_oom(n);
 
-    /*
-        volatile它告诉编译器不要对该变量进行优化，每次使用该变量都应该从内存中读取，
-        而不是使用寄存器中的值。
-        由于多个线程可能同时访问这个数组中的指针，
-        因此使用volatile可以确保多线程程序中对这些指针的读写操作是同步的。
-    */
-    //   _free_list表示存储自由链表数组的起始地址
-    static _Obj* volatile _free_list[__NFREELISTS];
+        //  重新分配内存
+        void *ret = realloc(p, n);
+        //  如果申请到了，返回申请到的内存地址
+        if (ret)
+        {
+            return (ret);
+        }
+    }
+}
 
-    //  狭义内存池的开始和结束标志
-    static char* _start_free;
-    static char* _end_free;
-    //  内存池大小
-    static size_t _heap_size;
+HandlerFunc __malloc_alloc_template::_handler = nullptr;
 
-    //  内存池基于freelist实现，需要考虑线程安全，加互斥锁
-    static std::mutex _mtx;
+__malloc_alloc_template::_Reclaimer __malloc_alloc_template::_reclaimers[__MAX_RECLAIMERS];
 
-public:
-    using value_type = T;
+size_t __malloc_alloc_template::_reclaimer_count = 0;
 
-    //  默认构造函数，使用noexcept说明不会抛出异常。
-    constexpr __default_alloc_template() noexcept {}
-    //  拷贝构造函数
-    constexpr __default_alloc_template(const __default_alloc_template&) noexcept = default;
-    //  模板拷贝构造函数
-    template <class _Other>
-    constexpr __default_alloc_template(const __default_alloc_template<_Other>&) noexcept {}
+std::mutex __malloc_alloc_template::_reclaim_mtx;
 
-    //对象构造
-    void construct(T* __p, const T& val) {
-        new (__p) T(val);
-    }
+thread_local bool __malloc_alloc_template::_reclaiming = false;
 
-    //对象析构
-    void destory(T* __p) {
-        __p->~T();
-    }
+size_t __malloc_alloc_template::_rss_limit = 0;
+
+size_t __malloc_alloc_template::_growth = 0;
+
+size_t __malloc_alloc_template::_allocations = 0;
+
+size_t __malloc_alloc_template::_frees = 0;
+
+size_t __malloc_alloc_template::_reallocations = 0;
+
+size_t __malloc_alloc_template::_bytes_requested = 0;
+
+size_t __malloc_alloc_template::_oom_calls = 0;
+
+size_t __malloc_alloc_template::_pressure_events = 0;
+
+//  二级配置器的chunk来源
+//  每次向系统映射一整块2MB对齐的2MB内存(region)，二级配置器的chunk都从region中切出，
+//  这样region可以用大页(huge page)映射，遍历链表结点时的TLB miss会大大减少
+//  多路(NUMA)机器上每个结点单独切分自己的region，并用mbind把region绑定到该结点的内存上
+class __region_alloc
+{
+public:
+    //  region的大小和对齐，与x86-64的大页大小相同
+    enum { __REGION_SIZE = 2 * 1024 * 1024 };
+    enum { __REGION_SHIFT = 21 };
+    //  最多支持的NUMA结点个数，编号更大的结点按取模折叠
+    enum { __MAX_NODES = 8 };
+    //  region开头放一张页表，每个4KB页占一项：前一半是所有者表，记录切分出这一页对象的线程编号，
+    //  后一半是大小类表，记录从这一页开始的对象所属的大小类+1，0表示还没有使用
+    enum { __PAGE_SHIFT = 12 };
+    enum { __PAGES = __REGION_SIZE >> __PAGE_SHIFT };
+    enum { __HEADER_BYTES = __PAGES * (sizeof(uint16_t) + sizeof(uint8_t)) };
+
+    //  一个结点上正在切分的region中还没有切出去的部分
+    //  页表中的大小类是按切分者自己的大小类表编号的，不同大小类表的二级配置器各用各的游标，
+    //  一个region只属于一个配置器，同一页上不会出现两套编号
+    struct cursor
+    {
+        char* _M_cur;
+        char* _M_end;
+    };
 
 private:
-    //  将bytes向上调整至8的倍数
-    static size_t _round_up(size_t __bytes)
+    //  region映射表：地址右移21位得到region编号(用户态48位地址，共27位)，
+    //  按高13位和低14位分成两级，叶子中记录region所属的结点编号+1，0表示不是region
+    enum { __MAP_LEAF_BITS = 14 };
+    enum { __MAP_ROOT_BITS = 48 - __REGION_SHIFT - __MAP_LEAF_BITS };
+
+    //  不使用页表的调用者(单调arena、单线程配置器)共用的游标，每个结点一个
+    static cursor _shared[__MAX_NODES];
+    //  已经映射的region个数
+    static size_t _region_count;
+    //  MAP_HUGETLB映射失败过一次(系统没有预留大页)，之后不再尝试
+    static bool _hugetlb_failed;
+    //  NUMA结点个数，0表示还没有探测
+    static int _node_count;
+    //  region映射表的第一级
+    static unsigned char* _map[1 << __MAP_ROOT_BITS];
+    //  保护上面的状态
+    static std::mutex _mtx;
+
+    //  读取/sys下的online结点列表(形如"0"或"0-1")，返回最大的结点编号+1
+    //  这里不能调用会分配内存的函数(fopen等)，它们可能又回到本配置器
+    static int _probe_nodes()
     {
-        return (((__bytes)+(size_t)__ALIGN - 1) & ~((size_t)__ALIGN - 1));
+        char __buf[64];
+        int __fd = open("/sys/devices/system/node/online", O_RDONLY);
+        if (__fd < 0)
+        {
+            return 1;
+        }
+        ssize_t __len = read(__fd, __buf, sizeof(__buf) - 1);
+        close(__fd);
+        if (__len <= 0)
+        {
+            return 1;
+        }
+        __buf[__len] = 0;
+        int __max = 0;
+        int __value = 0;
+        for (char* __c = __buf; ; __c++)
+        {
+            if (*__c >= '0' && *__c <= '9')
+            {
+                __value = __value * 10 + (*__c - '0');
+                continue;
+            }
+            if (__value > __max)
+            {
+                __max = __value;
+            }
+            __value = 0;
+            if (*__c == 0)
+            {
+                break;
+            }
+        }
+        return __max + 1 > (int)__MAX_NODES ? (int)__MAX_NODES : __max + 1;
     }
 
-    //  获取对应节点的下标
-    static size_t _freelist_index(size_t __bytes)
+    //  把region绑定到__node结点，之后第一次访问时内核会优先在该结点上分配物理页
+    //  mbind不可用(没有NUMA支持或被禁止)时忽略，退化为首次访问(first touch)策略：
+    //  切分region的线程运行在该结点上，它写入自由链表指针时物理页就分配在本地
+    static void _bind_region(char* __region, int __node)
     {
-        //  内存大小对齐至 8 的倍数，然后除以 8，得到对应的自由链表下标
-        return (((__bytes)+(size_t)__ALIGN - 1) / (size_t)__ALIGN - 1);
+#ifdef SYS_mbind
+        const int __mpol_preferred = 1;
+        unsigned long __mask = 1UL << __node;
+        syscall(SYS_mbind, __region, (unsigned long)__REGION_SIZE, __mpol_preferred,
+                &__mask, sizeof(__mask) * 8, 0);
+#endif
     }
 
-    //  将分配好的结点进行连接
-    static void* _refill(size_t __n)
+    //  在region映射表中记录__region属于__node结点，调用者需要持有_mtx
+    static void _map_set(char* __region, int __node)
     {
-        //  每次填充 20 个对象
-        int __nobjs = 20;
-        //  从内存池中获取一块大内存
-        char *__chunk = _chunk_alloc(__n, __nobjs);
-        _Obj* volatile* __my_free_list;
-        _Obj* __result;
-        //  free_list上的指针，指向内存块
-        _Obj* __current_obj;
-        _Obj* __next_obj;
-        int __i;
-
-        //  如果只分配了一个内存块，直接返回该内存块
-        if (__nobjs == 1)
-        {
-            return (__chunk);
-        }
-        //  获取内存池_free_list中与n对应的空闲链表，确定结点的位置
-        __my_free_list = _free_list + _freelist_index(__n);
-
-        //  将第一个内存块作为返回值
-        __result = (_Obj*)__chunk;
-        //  将剩余的内存块挂到空闲链表上
-        *__my_free_list = __next_obj = (_Obj*)(__chunk + __n);
-        for(__i = 1;; __i++)
-        {
-            __current_obj = __next_obj;
-            __next_obj = (_Obj*)((char*)__next_obj + __n);
-            //  如果是最后一个内存块，将其_M_free_list_link设为0
-            if (__nobjs - 1 == __i)
-            {
-                __current_obj->_M_free_list_link = 0;
-                break;
-            }
-                //  否则将其_M_free_list_link设为下一个内存块的地址
-            else
+        uintptr_t __id = (uintptr_t)__region >> __REGION_SHIFT;
+        unsigned char*& __leaf = _map[__id >> __MAP_LEAF_BITS];
+        if (__leaf == 0)
+        {
+            void* __p = mmap(0, (size_t)1 << __MAP_LEAF_BITS, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (__p == MAP_FAILED)
             {
-                __current_obj->_M_free_list_link = __next_obj;
+                return;
             }
+            __atomic_store_n(&__leaf, (unsigned char*)__p, __ATOMIC_RELEASE);
         }
-        //  返回第一个内存块的地址
-        return (__result);
+        __atomic_store_n(&__leaf[__id & ((1 << __MAP_LEAF_BITS) - 1)], (unsigned char)(__node + 1), __ATOMIC_RELEASE);
     }
 
-    //  在堆中分配一块大小为 n 的内存，返回起始地址
-    //  为了提高效率，每次分配的内存大小为 nobjs * n
-    static char* _chunk_alloc(size_t __size, int& __nobjs)
+    //  向系统映射一个2MB对齐的region，失败时返回0
+    static char* _map_region()
     {
-        //  用于保存返回值
-        char* __result;
-        //  请求分配的总字节数
-        size_t __total_bytes = __size * __nobjs;
-        //  内存池中剩余的字节数
-        size_t __bytes_left = _end_free - _start_free;
-
-        //  内存池中剩余空间足够，直接从内存池中分配
-        if (__bytes_left >= __total_bytes)
+#ifdef MAP_HUGETLB
+        //  系统预留了大页时直接用大页映射，地址天然按大页对齐
+        if (!_hugetlb_failed)
         {
-            //  返回内存池中可用空间的起始地址
-            __result = _start_free;
-            //  更新内存池起始地址
-            _start_free += __total_bytes;
-            return(__result);
+            void* __p = mmap(0, __REGION_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (__p != MAP_FAILED)
+            {
+                return (char*)__p;
+            }
+            _hugetlb_failed = true;
         }
-            //  内存池中剩余空间不足以满足请求，但可以分配至少一个对象
-        else if (__bytes_left >= __size)
+#endif
+        //  多映射一个region的大小，再把首尾不对齐的部分还给系统，得到2MB对齐的地址
+        void* __p = mmap(0, 2 * (size_t)__REGION_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (__p == MAP_FAILED)
         {
-            //  计算可以分配的对象数
-            __nobjs = (int)(__bytes_left / __size);
-            //  重新计算分配的总字节数
-            __total_bytes = __size * __nobjs;
-            //  返回内存池中可用空间的起始地址
-            __result = _start_free;
-            //  更新内存池起始地址
-            _start_free += __total_bytes;
-            return(__result);
+            return 0;
         }
-            //  内存池中剩余空间不足以分配一个对象，需要向系统申请内存
-        else
+        char* __base = (char*)__p;
+        char* __region = (char*)(((uintptr_t)__base + __REGION_SIZE - 1) & ~((uintptr_t)__REGION_SIZE - 1));
+        if (__region != __base)
         {
-            //  计算需要向系统申请多少字节的内存
-            size_t __bytes_to_get = 2 * __total_bytes + _round_up(_heap_size >> 4);
-            //  将内存池中剩余空间加入对应的 free list 中，这是对剩余小块内存重新利用
-            if (__bytes_left > 0)
-            {
-                _Obj* volatile* __my_free_list = _free_list + _freelist_index(__bytes_left);
-
-                //  当前自由链表节点指向真正的内存位置
-                ((_Obj*)_start_free)->_M_free_list_link = *__my_free_list;
-                *__my_free_list = (_Obj*)_start_free;
-            }
-            //  使用malloc一级空间配置器再次分配内存
-            _start_free = (char*)malloc(__bytes_to_get);
-            //  系统内存不足，需要重新调整 free list 并重试
-            if (_start_free == nullptr)
-            {
-                size_t __i;
-                _Obj* volatile* __my_free_list;
-                _Obj* __p;
-                for (__i = __size; __i <= (size_t)__MAX_BYTES; __i += (size_t)__ALIGN)
-                {
-                    __my_free_list = _free_list + _freelist_index(__i);
-                    __p = *__my_free_list;
-                    //  找到可用的 free list
-                    if (__p != 0)
-                    {
-                        *__my_free_list = __p->_M_free_list_link;
-                        _start_free = (char*)__p;
-                        _end_free = _start_free + __i;
-                        //  重新尝试分配
-                        return(_chunk_alloc(__size, __nobjs));
-                    }
-                }
-                //  所有的 free list 中都没有可用内存块，只能使用一级分配器
-                _end_free = 0;
-                _start_free = (char*)__malloc_alloc_template<0>::allocate(__bytes_to_get);
-            }
-            _heap_size += __bytes_to_get;
-            _end_free = _start_free + __bytes_to_get;
-            return(_chunk_alloc(__size, __nobjs));
+            munmap(__base, __region - __base);
         }
+        munmap(__region + __REGION_SIZE, __base + 2 * (size_t)__REGION_SIZE - (__region + __REGION_SIZE));
+#ifdef MADV_HUGEPAGE
+        //  请求内核用透明大页(THP)来映射这个region
+        madvise(__region, __REGION_SIZE, MADV_HUGEPAGE);
+#endif
+        return __region;
     }
 
 public:
-    //  开辟内存的函数，申请大小为__n的内存空间，返回指向申请内存的指针
-    T* allocate(size_t __n)
+    //  NUMA结点个数，单结点机器上为1
+    static int node_count()
     {
-        //  计算需要申请的内存空间的总大小
-        __n = __n * sizeof(T);
-        void* __ret = 0;
+        int __n = __atomic_load_n(&_node_count, __ATOMIC_ACQUIRE);
+        if (__n == 0)
+        {
+            //  多个线程同时探测得到的结果相同，不需要加锁
+            __n = _probe_nodes();
+            __atomic_store_n(&_node_count, __n, __ATOMIC_RELEASE);
+        }
+        return __n;
+    }
 
-        //  如果申请的内存空间超过了__MAX_BYTES（128B），使用第一级配置器
-        if ((size_t)__MAX_BYTES < __n)
+    //  当前线程正在运行的CPU所在的结点
+    static int current_node()
+    {
+        if (node_count() == 1)
         {
-            __ret = __malloc_alloc_template<0>::allocate(__n);
+            return 0;
         }
-            //  如果申请的内存空间小于等于_MAX_BYTES（128B），使用第二级配置器
-        else
+        unsigned __cpu = 0;
+        unsigned __node = 0;
+#ifdef SYS_getcpu
+        if (syscall(SYS_getcpu, &__cpu, &__node, 0) != 0)
         {
-            //  找到当前申请内存大小的内存块放置的位置（free_list中的位置）
-            //  使用volatile确保每次读取__my_free_list都是从它的原地址中读取，而不是编译器优化后的位置。
-            _Obj* volatile* __my_free_list = _free_list + _freelist_index(__n);
-            //  使用互斥锁进行保护，防止多个线程同时访问导致的冲突
-            std::lock_guard<std::mutex> guard (_mtx);
-
-            _Obj* __result = *__my_free_list;
-            //  如果当前位置没有挂载过内存块，调用_S_refill函数重新填充free_list
-            if (__result == 0)
-            {
-                __ret = _refill(_round_up(__n));
-            }
-            //  如果当前位置已经挂载了内存块，直接取出内存块，并将free_list上移一位
-            else {
-                *__my_free_list = __result->_M_free_list_link;
-                __ret = __result;
-            }
+            return 0;
         }
-        //  返回指向申请内存的指针
-        return (T*)__ret;
+#endif
+        return (int)(__node % (unsigned)node_count());
     }
 
-    //  释放内存
-    void deallocate(T* __p, size_t __n)
+    //  __p所在region所属的结点，不在任何region中时返回-1
+    static int node_of(const void* __p)
     {
-        //  判断内存块大小是否大于阈值_MAX_BYTES
-        if ((size_t)__MAX_BYTES < __n)
+        uintptr_t __id = (uintptr_t)__p >> __REGION_SHIFT;
+        if ((__id >> __MAP_LEAF_BITS) >= ((uintptr_t)1 << __MAP_ROOT_BITS))
         {
-            //  大于阈值，调用一级配置器的deallocate函数释放内存
-            __malloc_alloc_template<0>::deallocate(__p);
+            return -1;
         }
-            //  小于等于阈值
-        else
+        unsigned char* __leaf = __atomic_load_n(&_map[__id >> __MAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+        if (__leaf == 0)
         {
-            //  找到内存块对应的free_list的位置
-            //  使用volatile确保每次读取__my_free_list都是从它的原地址中读取，而不是编译器优化后的位置。
-            _Obj* volatile* __my_free_list = _free_list + _freelist_index(__n);
-            _Obj* __q = (_Obj*)__p;
-
-            //  进入临界区
-            std::lock_guard<std::mutex> guard(_mtx);
-
-            //  将释放的内存块链接到对应的free_list上
-            __q->_M_free_list_link = *__my_free_list;
-            *__my_free_list = __q;
+            return -1;
+        }
+        return (int)__atomic_load_n(&__leaf[__id & ((1 << __MAP_LEAF_BITS) - 1)], __ATOMIC_ACQUIRE) - 1;
+    }
+
+    //  为__node结点切出一块内存，优先使用游标__c所指region剩下的部分，最多__want字节，再补齐到页边界；
+    //  剩下的不足__min字节时映射新的region。实际切出的字节数放在__got中，失败时返回0
+    //  __min和__want都不能超过__REGION_SIZE
+    //  切出的一块总是在页边界结束，前后两块不会共用一页：页表记录的是从一页开始的对象的大小类，
+    //  chunk被trim释放后再复用时，如果和仍在使用的相邻chunk共用首尾页，切分时会改写对方对象所在页的记录
+    static void* allocate(cursor& __c, int __node, size_t __min, size_t __want, size_t& __got)
+    {
+        std::lock_guard<std::mutex> guard(_mtx);
+        if ((size_t)(__c._M_end - __c._M_cur) < __min)
+        {
+            char* __region = _map_region();
+            if (__region == 0)
+            {
+                return 0;
+            }
+            if (node_count() > 1)
+            {
+                _bind_region(__region, __node);
+            }
+            _map_set(__region, __node);
+            //  旧region中剩下的不足__min的尾巴直接放弃，它不会被访问，不占用物理内存
+            __c._M_cur = __region + __HEADER_BYTES;
+            __c._M_end = __region + __REGION_SIZE;
+            _region_count++;
+        }
+        size_t __left = __c._M_end - __c._M_cur;
+        __got = __left < __want ? __left : __want;
+        uintptr_t __page = (uintptr_t)1 << __PAGE_SHIFT;
+        __got = (((uintptr_t)__c._M_cur + __got + __page - 1) & ~(__page - 1)) - (uintptr_t)__c._M_cur;
+        void* __result = __c._M_cur;
+        __c._M_cur += __got;
+        return __result;
+    }
+
+    //  从__node结点共用的region中切出一块，切出的内存不能记入页表
+    static void* allocate(int __node, size_t __min, size_t __want, size_t& __got)
+    {
+        return allocate(_shared[__node], __node, __min, __want, __got);
+    }
+
+    //  查询__p所在页的所有者编号和大小类，不在region中时返回false
+    //  还没有记录过的页所有者为0，大小类为-1
+    static bool page_info(const void* __p, uint16_t& __owner, int& __cls)
+    {
+        if (node_of(__p) < 0)
+        {
+            return false;
+        }
+        char* __region = (char*)((uintptr_t)__p & ~((uintptr_t)__REGION_SIZE - 1));
+        size_t __page = ((uintptr_t)__p & ((uintptr_t)__REGION_SIZE - 1)) >> __PAGE_SHIFT;
+        __owner = __atomic_load_n(&((uint16_t*)__region)[__page], __ATOMIC_RELAXED);
+        __cls = (int)__atomic_load_n(&((uint8_t*)(__region + __PAGES * sizeof(uint16_t)))[__page],
+                                     __ATOMIC_RELAXED) - 1;
+        return true;
+    }
+
+    //  把[__begin, __end)覆盖的页记为__owner所有、大小类为__cls，__cls为-1时清除记录
+    //  这段内存必须在同一个region中，不在region中时忽略
+    static void set_pages(const void* __begin, const void* __end, uint16_t __owner, int __cls)
+    {
+        if (node_of(__begin) < 0)
+        {
+            return;
+        }
+        char* __region = (char*)((uintptr_t)__begin & ~((uintptr_t)__REGION_SIZE - 1));
+        uint16_t* __owners = (uint16_t*)__region;
+        uint8_t* __classes = (uint8_t*)(__region + __PAGES * sizeof(uint16_t));
+        size_t __first = ((uintptr_t)__begin & ((uintptr_t)__REGION_SIZE - 1)) >> __PAGE_SHIFT;
+        size_t __last = (((uintptr_t)__end - 1) & ((uintptr_t)__REGION_SIZE - 1)) >> __PAGE_SHIFT;
+        for (size_t __i = __first; __i <= __last; __i++)
+        {
+            __atomic_store_n(&__owners[__i], __owner, __ATOMIC_RELAXED);
+            __atomic_store_n(&__classes[__i], (uint8_t)(__cls + 1), __ATOMIC_RELAXED);
+        }
+    }
+
+    //  已经映射的region个数
+    static size_t region_count()
+    {
+        std::lock_guard<std::mutex> guard(_mtx);
+        return _region_count;
+    }
+
+    //  fork前后由__default_alloc_template::lock_all/unlock_all调用
+    static void lock()
+    {
+        _mtx.lock();
+    }
+
+    static void unlock()
+    {
+        _mtx.unlock();
+    }
+};
+
+__region_alloc::cursor __region_alloc::_shared[__MAX_NODES];
+
+size_t __region_alloc::_region_count = 0;
+
+bool __region_alloc::_hugetlb_failed = false;
+
+int __region_alloc::_node_count = 0;
+
+unsigned char* __region_alloc::_map[1 << __MAP_ROOT_BITS];
+
+std::mutex __region_alloc::_mtx;
+
+//  分配记录器：打开之后，二级配置器的allocate/deallocate/reallocate每次调用都会
+//  在本线程的缓冲区里追加一条定长的二进制记录，缓冲区写满、调用flush()或线程退出时
+//  整块写入文件，之后可以用bench/replay离线重放，比较不同配置器在同一份负载下的表现
+//  关闭时热路径上只多一次对_enabled的读
+class __alloc_trace
+{
+public:
+    enum op_type { op_allocate = 0, op_deallocate = 1, op_reallocate = 2 };
+
+    //  一条记录32字节
+    struct record
+    {
+        //  距离start()的纳秒数
+        uint64_t timestamp;
+        //  对象的地址，作为对象的标识，重放时用它把释放和分配对应起来
+        uint64_t id;
+        //  reallocate之前的地址，其他操作为0
+        uint64_t old_id;
+        //  请求的字节数，reallocate为新的大小
+        uint32_t size;
+        //  线程编号，按线程第一次写记录的顺序从0开始
+        uint16_t thread;
+        uint8_t op;
+        uint8_t reserved;
+    };
+
+    //  文件开头的头部，后面紧跟着若干条record
+    struct file_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+    };
+
+private:
+    //  每个线程缓冲区能放的记录条数
+    enum { __BUFFER_RECORDS = 4096 };
+
+    //  每个线程的缓冲区，用mmap申请，不经过被记录的配置器，也不会递归
+    struct _Buffer
+    {
+        record* _M_records;
+        size_t _M_count;
+        uint16_t _M_thread;
+
+        _Buffer() : _M_records(0), _M_count(0), _M_thread(0) {}
+
+        ~_Buffer()
+        {
+            _flush(*this);
+            if (_M_records != 0)
+            {
+                munmap(_M_records, __BUFFER_RECORDS * sizeof(record));
+            }
+        }
+    };
+
+    static bool _enabled;
+    static int _fd;
+    static uint64_t _start_ns;
+    static uint16_t _next_thread;
+    static std::mutex _file_mtx;
+    static thread_local _Buffer _buffer;
+
+    static uint64_t _now()
+    {
+        struct timespec __ts;
+        clock_gettime(CLOCK_MONOTONIC, &__ts);
+        return (uint64_t)__ts.tv_sec * 1000000000ull + (uint64_t)__ts.tv_nsec;
+    }
+
+    //  把缓冲区里的记录写进文件，文件已经关闭时丢弃
+    static void _flush(_Buffer& __buf)
+    {
+        if (__buf._M_count == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(_file_mtx);
+        if (_fd >= 0)
+        {
+            const char* __p = (const char*)__buf._M_records;
+            size_t __left = __buf._M_count * sizeof(record);
+            while (__left > 0)
+            {
+                ssize_t __n = write(_fd, __p, __left);
+                if (__n <= 0)
+                {
+                    break;
+                }
+                __p += __n;
+                __left -= (size_t)__n;
+            }
+        }
+        __buf._M_count = 0;
+    }
+
+public:
+    //  打开记录文件并开始记录，文件已存在时截断；已经在记录或打开失败返回false
+    static bool start(const char* __path)
+    {
+        std::lock_guard<std::mutex> guard(_file_mtx);
+        if (_fd >= 0)
+        {
+            return false;
+        }
+        int __fd = open(__path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (__fd < 0)
+        {
+            return false;
+        }
+        file_header __h;
+        std::memcpy(__h.magic, "ALLOCTRC", 8);
+        __h.version = 1;
+        __h.record_size = sizeof(record);
+        if (write(__fd, &__h, sizeof(__h)) != (ssize_t)sizeof(__h))
+        {
+            close(__fd);
+            return false;
+        }
+        _fd = __fd;
+        _start_ns = _now();
+        __atomic_store_n(&_enabled, true, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    //  停止记录，写出本线程的缓冲区并关闭文件
+    //  其他线程缓冲区里还没写出的记录会丢失，需要它们在此之前调用flush()或者退出
+    static void stop()
+    {
+        __atomic_store_n(&_enabled, false, __ATOMIC_RELEASE);
+        _flush(_buffer);
+        std::lock_guard<std::mutex> guard(_file_mtx);
+        if (_fd >= 0)
+        {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    //  把本线程缓冲区里的记录写进文件
+    static void flush()
+    {
+        _flush(_buffer);
+    }
+
+    static bool enabled()
+    {
+        return __atomic_load_n(&_enabled, __ATOMIC_RELAXED);
+    }
+
+    //  fork前后由__default_alloc_base::lock_all/unlock_all调用
+    static void lock()
+    {
+        _file_mtx.lock();
+    }
+
+    static void unlock()
+    {
+        _file_mtx.unlock();
+    }
+
+    //  追加一条记录，__old_id是reallocate之前的地址，这时那块内存可能已经释放，按整数传入
+    static void log(op_type __op, const void* __id, uintptr_t __old_id, size_t __size)
+    {
+        _Buffer& __buf = _buffer;
+        if (__buf._M_records == 0)
+        {
+            void* __mem = mmap(0, __BUFFER_RECORDS * sizeof(record), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (__mem == MAP_FAILED)
+            {
+                return;
+            }
+            __buf._M_records = (record*)__mem;
+            __buf._M_thread = __atomic_fetch_add(&_next_thread, 1, __ATOMIC_RELAXED);
+        }
+        record& __r = __buf._M_records[__buf._M_count];
+        __r.timestamp = _now() - _start_ns;
+        __r.id = (uint64_t)(uintptr_t)__id;
+        __r.old_id = (uint64_t)__old_id;
+        __r.size = __size > 0xffffffffu ? 0xffffffffu : (uint32_t)__size;
+        __r.thread = __buf._M_thread;
+        __r.op = (uint8_t)__op;
+        __r.reserved = 0;
+        if (++__buf._M_count == __BUFFER_RECORDS)
+        {
+            _flush(__buf);
+        }
+    }
+};
+
+bool __alloc_trace::_enabled = false;
+
+int __alloc_trace::_fd = -1;
+
+uint64_t __alloc_trace::_start_ns = 0;
+
+uint16_t __alloc_trace::_next_thread = 0;
+
+std::mutex __alloc_trace::_file_mtx;
+
+thread_local __alloc_trace::_Buffer __alloc_trace::_buffer;
+
+//  编译期求__n以2为底的对数，__n是2的幂
+template <size_t __n>
+struct __static_log2
+{
+    enum { value = 1 + __static_log2<__n / 2>::value };
+};
+
+template <>
+struct __static_log2<1>
+{
+    enum { value = 0 };
+};
+
+//  二级配置器的大小类表，作为模板参数传给__basic_default_alloc，可以按负载调整
+//  不超过_SmallBytes的小对象以_Align字节为间隔，(_SmallBytes, _MaxBytes]之间的中等对象
+//  每个2的幂区间(2^k, 2^(k+1)]再等分成_MediumSteps份；下标和大小的换算都是constexpr，
+//  大小在编译期已知时下标也在编译期求出
+template <size_t _Align, size_t _SmallBytes, size_t _MediumSteps, size_t _MaxBytes>
+struct __size_classes
+{
+    enum { align = _Align };
+    enum { small_bytes = _SmallBytes };
+    enum { medium_steps = _MediumSteps };
+    enum { max_bytes = _MaxBytes };
+    //  小对象大小类的个数
+    enum { small_classes = _SmallBytes / _Align };
+    //  大小类的总个数 = 小对象 + (_SmallBytes, _MaxBytes]之间的2的幂区间个数 * _MediumSteps
+    enum { classes = small_classes
+                     + (__static_log2<_MaxBytes>::value - __static_log2<_SmallBytes>::value) * _MediumSteps };
+
+    //  自由链表的节点要放下一个指针
+    static_assert(_Align >= sizeof(void*) && (_Align & (_Align - 1)) == 0,
+                  "_Align must be a power of two no smaller than a pointer");
+    static_assert((_SmallBytes & (_SmallBytes - 1)) == 0 && _SmallBytes >= _Align,
+                  "_SmallBytes must be a power of two no smaller than _Align");
+    static_assert((_MaxBytes & (_MaxBytes - 1)) == 0 && _MaxBytes >= _SmallBytes,
+                  "_MaxBytes must be a power of two no smaller than _SmallBytes");
+    //  中等对象的大小也要是_Align的倍数
+    static_assert(_MediumSteps != 0 && (_MediumSteps & (_MediumSteps - 1)) == 0
+                  && _SmallBytes / _MediumSteps >= _Align,
+                  "_MediumSteps must be a power of two dividing _SmallBytes into multiples of _Align");
+    //  page map中每页用一个字节记录大小类下标+1
+    static_assert(classes <= 255, "too many size classes for the page map");
+
+    //  C++11的constexpr函数只能有一条return语句，下面都写成单个表达式，C++11下也能在编译期求值
+
+    //  能放下__bytes字节的最小大小类的下标，__bytes在[1, _MaxBytes]之间
+    static constexpr size_t index(size_t __bytes)
+    {
+        return __bytes <= _SmallBytes
+               ? (__bytes + _Align - 1) / _Align - 1
+               : _medium_index(__bytes, 63 - __builtin_clzll((unsigned long long)(__bytes - 1)));
+    }
+
+    //  第__index个大小类的对象大小，index的逆运算
+    static constexpr size_t size(size_t __index)
+    {
+        return __index < (size_t)small_classes
+               ? (__index + 1) * _Align
+               : _medium_size(_SmallBytes << ((__index - small_classes) / _MediumSteps),
+                              (__index - small_classes) % _MediumSteps);
+    }
+
+    //  中等对象所在的2的幂区间是(2^__lg, 2^(__lg+1)]，区间等分成_MediumSteps份，再算出在区间内的第几份
+    static constexpr size_t _medium_index(size_t __bytes, size_t __lg)
+    {
+        return small_classes + (__lg - __static_log2<_SmallBytes>::value) * _MediumSteps
+               + (__bytes - 1 - ((size_t)1 << __lg)) / (((size_t)1 << __lg) / _MediumSteps);
+    }
+
+    //  区间下界为__base时第__step份的大小
+    static constexpr size_t _medium_size(size_t __base, size_t __step)
+    {
+        return __base + (__step + 1) * (__base / _MediumSteps);
+    }
+};
+
+//  默认的大小类：8字节间隔到128，之后每个2的幂区间4份，即160,192,224,256,320,384,...,32768，
+//  一共48个，相邻大小类之间最多浪费25%的空间
+typedef __size_classes<8, 128, 4, 32768> __default_size_classes;
+
+//  二级配置器，大小类由_Classes决定，程序中一般使用默认大小类的__default_alloc_template
+//  不同的_Classes各自有一套独立的内存池，chunk都来自同一个region
+template <class _Classes>
+class __basic_default_alloc
+{
+private:
+    //  小对象的自由链表是从_Classes::align字节开始，以它为间隔，一直扩充到_Classes::small_bytes
+    //  默认是8字节间隔到128，超过128字节的中等对象按几何间隔划分
+    enum { __ALIGN = _Classes::align };
+    //  自由链表的最大结点，超过它的才交给一级配置器
+    enum { __MAX_BYTES = _Classes::max_bytes };
+    //  自由链表的个数
+    enum { __NFREELISTS = _Classes::classes };
+    //  每个大小类的对象都按它的自然对齐切分：大小中2的幂因子，最多64字节
+    //  例如16、48字节的对象16字节对齐，32、96字节的32字节对齐，64及其倍数64字节对齐
+    //  对齐要求超过64字节的交给一级配置器
+    enum { __MAX_ALIGN = 64 };
+
+    //  自由链表的节点类型
+    union _Obj
+    {
+        //  存储下一个节点的地址
+        union  _Obj* _M_free_list_link;
+        //  存放用户的数据
+        char _M_client_data[1];
+    };
+
+    /*
+        全局自由链表是一个无锁栈(Treiber栈)，push/pop都通过对链表头做CAS完成，不需要加锁。
+        volatile并不能提供线程间的同步，这里改用原子操作。
+        单纯对指针做CAS会有ABA问题：线程A读到栈顶X和X->next=Y后被挂起，
+        其他线程弹出X、Y，再把X压回栈顶，A的CAS仍然会成功，栈顶却被错误地设成了已经被占用的Y。
+        所以链表头由指针和版本号组成，每次修改版本号都加一，X被压回后版本号已经不同，A的CAS必然失败。
+    */
+    struct _LockFreeList
+    {
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+        //  支持16字节CAS(cmpxchg16b)时，指针和64位版本号各占8字节，版本号不会回绕
+        struct alignas(16) _Head
+        {
+            _Obj* _M_ptr;
+            uintptr_t _M_tag;
+        };
+
+        _Head _M_head;
+
+        _Head _load() const
+        {
+            //  不要求两半一致：读到撕裂的值时下面的CAS一定失败，重试即可
+            _Head __h;
+            __h._M_tag = __atomic_load_n(&_M_head._M_tag, __ATOMIC_ACQUIRE);
+            __h._M_ptr = __atomic_load_n(&_M_head._M_ptr, __ATOMIC_ACQUIRE);
+            return __h;
+        }
+
+        static _Obj* _ptr(const _Head& __h) { return __h._M_ptr; }
+
+        bool _cas(const _Head& __old, _Obj* __p)
+        {
+            _Head __new = { __p, __old._M_tag + 1 };
+            unsigned __int128 __o, __n;
+            std::memcpy(&__o, &__old, sizeof(__o));
+            std::memcpy(&__n, &__new, sizeof(__n));
+            return __sync_bool_compare_and_swap((unsigned __int128*)&_M_head, __o, __n);
+        }
+#else
+        //  否则把16位版本号放在指针的高16位，用户态地址只用到低48位
+        typedef uintptr_t _Head;
+        enum { __PTR_BITS = 48 };
+
+        _Head _M_head;
+
+        _Head _load() const
+        {
+            return __atomic_load_n(&_M_head, __ATOMIC_ACQUIRE);
+        }
+
+        static _Obj* _ptr(_Head __h)
+        {
+            return (_Obj*)(__h & (((uintptr_t)1 << __PTR_BITS) - 1));
+        }
+
+        bool _cas(_Head __old, _Obj* __p)
+        {
+            _Head __new = (((__old >> __PTR_BITS) + 1) << __PTR_BITS) | (uintptr_t)__p;
+            return __atomic_compare_exchange_n(&_M_head, &__old, __new, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        }
+#endif
+
+        //  把[__first, __last]这一段已经连好的链表一次性压入栈顶
+        void push(_Obj* __first, _Obj* __last)
+        {
+            _Head __old;
+            do
+            {
+                __old = _load();
+                __last->_M_free_list_link = _ptr(__old);
+            } while (!_cas(__old, __first));
+        }
+
+        //  弹出栈顶的一个对象，栈为空时返回0
+        _Obj* pop()
+        {
+            _Head __old;
+            _Obj* __p;
+            do
+            {
+                __old = _load();
+                __p = _ptr(__old);
+                if (__p == 0)
+                {
+                    return 0;
+                }
+                //  __p可能已经被其他线程弹出并写入了用户数据，此时读到的next无意义，
+                //  但版本号已经改变，CAS会失败。池中的内存不会还给系统，所以这里的读取总是安全的
+            } while (!_cas(__old, __atomic_load_n(&__p->_M_free_list_link, __ATOMIC_RELAXED)));
+            return __p;
+        }
+
+        //  一次性取下整条链表，栈为空时返回0
+        _Obj* pop_all()
+        {
+            _Head __old;
+            do
+            {
+                __old = _load();
+                if (_ptr(__old) == 0)
+                {
+                    return 0;
+                }
+            } while (!_cas(__old, 0));
+            return _ptr(__old);
+        }
+    };
+
+    //  每块从系统申请的内存(chunk)头部的记录
+    //  所有chunk串成一条链表，trim时据此统计每个chunk中空闲对象占用的字节数
+    struct _Chunk
+    {
+        //  下一个chunk
+        _Chunk* _M_next;
+        //  头部之后可以切分的字节数
+        size_t _M_size;
+        //  trim时统计出的空闲字节数
+        size_t _M_free;
+        //  对齐或者凑整页时跳过、不会再切分出去的字节数，trim时同样当作空闲
+        size_t _M_waste;
+        //  物理页是否已经通过madvise还给了系统，等待被_chunk_alloc复用
+        size_t _M_released;
+
+        char* _begin() { return (char*)(this + 1); }
+        char* _end() { return _begin() + _M_size; }
+    };
+
+    //  每个NUMA结点一个内存池(arena)，线程从自己所在结点的arena中分配，
+    //  arena的chunk都从本结点的region中切出，拿到的内存总在本地结点上
+    //  单结点机器上只有一个arena，行为与原来的全局内存池相同
+    struct _Arena
+    {
+        //  _M_free_list表示存储自由链表数组的起始地址，每个大小的自由链表都是一个无锁栈
+        _LockFreeList _M_free_list[__NFREELISTS];
+
+        //  狭义内存池的开始和结束标志
+        char* _M_start_free;
+        char* _M_end_free;
+        //  内存池剩下的部分所在的chunk，跳过的字节记在它上面
+        _Chunk* _M_pool_chunk;
+        //  内存池剩下的部分来自新从region切出的chunk，还没有被写过，内容全是0
+        //  trim之后复用的chunk不一定全是0，为false
+        bool _M_zero_free;
+        //  内存池大小，trim把chunk还给系统后会相应减少
+        size_t _M_heap_size;
+        //  内存池大小的最大值(高水位)
+        size_t _M_heap_peak;
+
+        //  本arena所有chunk组成的链表及个数，由_M_mtx保护
+        _Chunk* _M_chunk_list;
+        size_t _M_chunk_count;
+
+        //  自适应填充控制器的状态，由_M_mtx保护
+        //  arena总共切分的次数，作为控制器的时钟
+        size_t _M_tick;
+        //  每个大小类下一次切分的对象个数，0表示还没有切分过
+        size_t _M_refill_batch[__NFREELISTS];
+        //  每个大小类上一次切分时的时钟
+        size_t _M_refill_last[__NFREELISTS];
+        //  每个大小类切分的次数
+        size_t _M_refills[__NFREELISTS];
+        //  每个大小类切分出去的字节数
+        size_t _M_carved_bytes[__NFREELISTS];
+        //  每个大小类现存的对象个数(切分出来的减去trim还给系统的)，
+        //  减去正在使用的个数就是挂在各级自由链表上的个数
+        size_t _M_objects[__NFREELISTS];
+        //  向region申请新chunk时额外多要的字节数，以及上一次申请时的时钟
+        size_t _M_chunk_grow;
+        size_t _M_chunk_last;
+        //  本arena切分chunk的region，只属于这个配置器，由region的锁保护
+        __region_alloc::cursor _M_regions;
+
+        //  自由链表本身是无锁的，互斥锁只保护从内存池切分新对象的慢路径(_refill/_chunk_alloc)
+        std::mutex _M_mtx;
+    };
+
+    //  自适应填充：同一个大小类两次切分之间arena的切分次数不超过__REFILL_HOT_GAP，认为它很热，
+    //  下次切分的个数翻倍(慢启动)；超过__REFILL_COLD_GAP认为已经变冷，下次切分的个数减半
+    enum { __REFILL_HOT_GAP = 8 };
+    enum { __REFILL_COLD_GAP = 256 };
+    //  第一次切分的个数和最少切分的个数
+    enum { __REFILL_INIT = 8 };
+    enum { __REFILL_MIN = 2 };
+    //  chunk的增长：两次向region申请之间的切分次数不超过__CHUNK_HOT_GAP时额外部分翻倍，
+    //  超过__CHUNK_COLD_GAP时减半，范围在[__CHUNK_GROW_MIN, __CHUNK_GROW_MAX]之间
+    enum { __CHUNK_HOT_GAP = 4 };
+    enum { __CHUNK_COLD_GAP = 64 };
+    enum { __CHUNK_GROW_MIN = 16 * 1024 };
+    enum { __CHUNK_GROW_MAX = 1024 * 1024 };
+
+    //  所有结点的arena，下标就是结点编号
+    static _Arena _arenas[__region_alloc::__MAX_NODES];
+
+    //  程序启动时把trim注册为一级配置器的回收函数，优先级为0
+    struct _TrimReclaimer
+    {
+        static size_t _reclaim(size_t)
+        {
+            return trim();
+        }
+
+        _TrimReclaimer()
+        {
+            __malloc_alloc_template::add_reclaimer(_reclaim, 0, "pool trim");
+        }
+    };
+    static _TrimReclaimer _trim_reclaimer;
+
+    //  线程本地缓存中每条自由链表最多保存的对象个数，超过后批量归还给全局自由链表
+    enum { __TCACHE_MAX = 64 };
+    //  大对象按字节数限制缓存的个数，避免每个线程都囤积几十个32K的对象
+    enum { __TCACHE_BYTES = 64 * 1024 };
+    //  每条链表至少允许缓存的对象个数
+    enum { __TCACHE_MIN = 4 };
+
+    //  统计计数只由本线程写，其他线程汇总时读，用relaxed原子操作避免数据竞争，
+    //  在x86上与普通的加法生成相同的指令
+    static void _count(size_t& __counter)
+    {
+        __atomic_store_n(&__counter, __counter + 1, __ATOMIC_RELAXED);
+    }
+
+    //  线程每填充这么多次缓存，重新确认一次自己所在的结点(线程可能被调度到别的结点上)
+    enum { __NODE_RECHECK = 64 };
+    //  远程释放队列的个数，线程编号从1开始，编号用完之后新线程的编号为0，不使用远程队列
+    enum { __MAX_OWNERS = 256 };
+    //  释放给同一个线程的对象先在本线程攒够这么多个，再用一次CAS整段压入它的远程队列
+    enum { __REMOTE_BATCH = 16 };
+
+    //  线程本地缓存，每个线程持有一份，挂在arena的自由链表之前
+    //  allocate/deallocate的快速路径只操作本线程的链表，不需要加锁，
+    //  只有缓存为空或者过满时才加锁和全局自由链表批量交换对象
+    struct _ThreadCache
+    {
+        //  与_free_list一一对应的本线程自由链表，只有本线程访问，用普通指针即可
+        _Obj* _M_list[__NFREELISTS];
+        //  每条链表上缓存的对象个数
+        size_t _M_count[__NFREELISTS];
+        //  本线程正在切分的span：_refill从内存池切下一段连续的对象后不再串成链表，
+        //  [_M_span_cur, _M_span_end)中的对象在自由链表用完之后按地址顺序逐个取出
+        //  _M_list是span上由本线程释放的对象，远程释放队列是其他线程延迟归还的对象
+        char* _M_span_cur[__NFREELISTS];
+        char* _M_span_end[__NFREELISTS];
+        //  span切自内容全是0的内存，还没有取出的对象不需要再清零
+        bool _M_span_zero[__NFREELISTS];
+        //  本线程所在的结点，-1表示还没有确定
+        int _M_node;
+        //  本线程的编号，切分对象时记在region的所有者表中，也是远程释放队列的下标
+        uint16_t _M_owner;
+        //  填充缓存的次数，用于定期重新确认所在结点
+        unsigned _M_fills;
+        //  析构函数已经执行：线程退出的后期glibc和libstdc++还会调用malloc/free，
+        //  这时的分配和释放不再经过缓存，直接交给arena
+        bool _M_dead;
+        //  准备压入其他线程远程队列的对象，每个大小类攒一段，属于同一个线程
+        _Obj* _M_remote_first[__NFREELISTS];
+        _Obj* _M_remote_last[__NFREELISTS];
+        size_t _M_remote_count[__NFREELISTS];
+        uint16_t _M_remote_owner[__NFREELISTS];
+        //  本线程的分配/释放次数，stats()读取时汇总所有线程的计数
+        size_t _M_allocs[__NFREELISTS];
+        size_t _M_frees[__NFREELISTS];
+        //  所有线程缓存串成一条双向链表，供stats()遍历
+        _ThreadCache* _M_prev;
+        _ThreadCache* _M_next;
+
+        _ThreadCache() : _M_node(-1), _M_owner(0), _M_fills(0), _M_dead(false), _M_prev(0)
+        {
+            //  模板的静态成员用到时才会实例化，这里引用一次，保证trim注册为回收函数
+            (void)&_trim_reclaimer;
+            //  数组成员不在这里清零：thread_local对象在构造之前已经零初始化，
+            //  而线程第一次进入配置器时，同一编译单元中其他thread_local对象(__alloc_trace的缓冲区、
+            //  __arena_alloc的默认arena)先初始化，注册它们的析构函数会调用malloc，
+            //  被替换的malloc此时已经在使用这份还没有构造的缓存，清零会把放进来的对象丢掉
+
+            std::lock_guard<std::mutex> guard(_registry_mtx);
+            //  优先复用已退出线程的编号
+            if (_free_owner_count != 0)
+            {
+                _M_owner = _free_owners[--_free_owner_count];
+            }
+            else if (_next_owner < (size_t)__MAX_OWNERS)
+            {
+                _M_owner = (uint16_t)_next_owner++;
+            }
+            _M_next = _registry;
+            if (_registry != 0)
+            {
+                _registry->_M_prev = this;
+            }
+            _registry = this;
+        }
+
+        //  线程退出时，把缓存中的所有对象归还给全局自由链表，避免内存随线程一起丢失
+        //  计数累加到已退出线程的总数中
+        ~_ThreadCache()
+        {
+            for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+            {
+                _remote_flush(*this, __i);
+                _remote_take(*this, _M_owner, __i);
+                _span_release(*this, __i);
+                if (_M_count[__i] != 0)
+                {
+                    _tcache_flush(*this, __i, _M_count[__i]);
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(_registry_mtx);
+            for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+            {
+                _retired_allocs[__i] += _M_allocs[__i];
+                _retired_frees[__i] += _M_frees[__i];
+            }
+            //  编号归还之后仍可能有其他线程往它的远程队列里放对象，下一个拿到这个编号的线程会取走
+            if (_M_owner != 0)
+            {
+                _free_owners[_free_owner_count++] = _M_owner;
+            }
+            //  之后再切分的对象不属于任何线程，释放时不会进入远程队列
+            _M_owner = 0;
+            _M_dead = true;
+            if (_M_prev != 0)
+            {
+                _M_prev->_M_next = _M_next;
+            }
+            else
+            {
+                _registry = _M_next;
+            }
+            if (_M_next != 0)
+            {
+                _M_next->_M_prev = _M_prev;
+            }
+        }
+    };
+
+    //  每个线程自己的缓存
+    static thread_local _ThreadCache _tcache;
+
+    //  存活线程缓存组成的链表，以及已经退出的线程留下的计数，由_registry_mtx保护
+    static _ThreadCache* _registry;
+    static size_t _retired_allocs[__NFREELISTS];
+    static size_t _retired_frees[__NFREELISTS];
+    static std::mutex _registry_mtx;
+
+    //  远程释放队列：线程释放不是自己切分出来的对象时，把它(攒成一批后)压入切分者的队列，
+    //  切分者在本线程缓存为空时用一次原子交换整条取回，生产者/消费者模式下
+    //  释放方不再和其他线程争用arena的自由链表。队列只有压入和整条取出，没有ABA问题
+    static _Obj* _remote[__MAX_OWNERS][__NFREELISTS];
+    //  远程队列可能非空的线程编号，每个编号一位：压入远程队列后置位，
+    //  trim把整个字清零之后只检查置位的编号，不用每次扫描全部__MAX_OWNERS * __NFREELISTS个队列
+    enum { __OWNER_WORDS = __MAX_OWNERS / 64 };
+    static uint64_t _remote_pending[__OWNER_WORDS];
+    //  线程编号的分配，由_registry_mtx保护，0号保留
+    static size_t _next_owner;
+    static uint16_t _free_owners[__MAX_OWNERS];
+    static size_t _free_owner_count;
+
+public:
+
+    //  默认构造函数，使用noexcept说明不会抛出异常。
+    constexpr __basic_default_alloc() noexcept {}
+    //  拷贝构造函数
+    constexpr __basic_default_alloc(const __basic_default_alloc&) noexcept = default;
+
+    //  单线程配置器使用相同的大小类
+    template <class> friend class __basic_single_thread_alloc;
+
+    //  内存池负责的最大字节数，超过它的交给一级配置器
+    enum { max_bytes = __MAX_BYTES };
+    //  大小类表，simple_alloc用它在编译期求出单个对象的大小类下标
+    typedef _Classes size_classes;
+
+private:
+    //  获取对应节点的下标
+    static constexpr size_t _freelist_index(size_t __bytes)
+    {
+        return _Classes::index(__bytes);
+    }
+
+    //  第__index条自由链表上每个对象的大小，_freelist_index的逆运算
+    static constexpr size_t _class_size(size_t __index)
+    {
+        return _Classes::size(__index);
+    }
+
+    //  第__index条自由链表上对象的对齐字节数
+    static size_t _class_align(size_t __index)
+    {
+        size_t __size = _class_size(__index);
+        size_t __align = __size & (0 - __size);
+        return __align > (size_t)__MAX_ALIGN ? (size_t)__MAX_ALIGN : __align;
+    }
+
+    //  能放下__n字节、并且按__align对齐的最小大小类
+    static size_t _aligned_index(size_t __n, size_t __align)
+    {
+        size_t __index = _freelist_index(__n < __align ? __align : __n);
+        while (_class_align(__index) < __align)
+        {
+            __index++;
+        }
+        return __index;
+    }
+
+    //  第__index条自由链表在本线程缓存中最多保存的对象个数
+    static size_t _tcache_limit(size_t __index)
+    {
+        size_t __limit = (size_t)__TCACHE_BYTES / _class_size(__index);
+        if (__limit > (size_t)__TCACHE_MAX)
+        {
+            __limit = __TCACHE_MAX;
+        }
+        if (__limit < (size_t)__TCACHE_MIN)
+        {
+            __limit = __TCACHE_MIN;
+        }
+        return __limit;
+    }
+
+#ifdef __ALLOC_HAS_RSEQ
+    //  每个CPU一份的缓存：每个大小类一个指针栈，容量与线程缓存的上限相同
+    //  线程很多时缓存占用的内存只和CPU个数有关，第一次在某个CPU上使用时才映射
+    enum { __MAX_CPUS = 1024 };
+    struct _CpuCache
+    {
+        size_t _M_count[__NFREELISTS];
+        void* _M_slots[__NFREELISTS][__TCACHE_MAX];
+    };
+    static _CpuCache* _cpu_caches[__MAX_CPUS];
+    static std::mutex _cpu_mtx;
+
+    //  glibc为每个线程注册的struct rseq，只用到前面几个字段，布局是内核ABI的一部分
+    struct _RseqArea
+    {
+        uint32_t _M_cpu_id_start;
+        uint32_t _M_cpu_id;
+        uint64_t _M_rseq_cs;
+        uint32_t _M_flags;
+    };
+
+    static _RseqArea* _rseq()
+    {
+        return (_RseqArea*)((char*)__builtin_thread_pointer() + __rseq_offset);
+    }
+
+    //  当前线程所在CPU的编号和它的缓存，rseq不可用时返回-1
+    static int _cpu_current(_RseqArea* __rs, _CpuCache*& __cache)
+    {
+        int __cpu = (int)__atomic_load_n(&__rs->_M_cpu_id, __ATOMIC_RELAXED);
+        if (__cpu < 0 || __cpu >= (int)__MAX_CPUS)
+        {
+            return -1;
+        }
+        __cache = __atomic_load_n(&_cpu_caches[__cpu], __ATOMIC_ACQUIRE);
+        if (__cache == 0)
+        {
+            std::lock_guard<std::mutex> guard(_cpu_mtx);
+            __cache = _cpu_caches[__cpu];
+            if (__cache == 0)
+            {
+                void* __mem = mmap(0, sizeof(_CpuCache), PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (__mem == MAP_FAILED)
+                {
+                    return -1;
+                }
+                __cache = (_CpuCache*)__mem;
+                __atomic_store_n(&_cpu_caches[__cpu], __cache, __ATOMIC_RELEASE);
+            }
+        }
+        return __cpu;
+    }
+
+    //  rseq临界区：从标号1到2之间被抢占、迁移或者收到信号时，内核让线程从标号4重新开始，
+    //  4之前放4字节的签名RSEQ_SIG；临界区先确认仍在__cpu号CPU上，最后一条写操作提交
+    //  在__cpu号CPU的缓存中压入__p，返回0表示成功，1表示栈满，-1表示被打断、需要重新确定CPU
+    static int _rseq_push(_RseqArea* __rs, int __cpu, size_t* __count, void** __slots,
+                          size_t __cap, void* __p)
+    {
+        asm goto (
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %[rseq_cs]\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %[cpu_id]\n\t"
+            "jnz 4f\n\t"
+            "movq (%[count]), %%rax\n\t"
+            "cmpq %[cap], %%rax\n\t"
+            "jae %l[full]\n\t"
+            "movq %[p], (%[slots], %%rax, 8)\n\t"
+            "addq $1, %%rax\n\t"
+            "movq %%rax, (%[count])\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[abort]\n\t"
+            ".popsection\n\t"
+            :
+            : [rseq_cs] "m" (__rs->_M_rseq_cs), [cpu_id] "m" (__rs->_M_cpu_id), [cpu] "r" (__cpu),
+              [count] "r" (__count), [slots] "r" (__slots), [cap] "r" (__cap), [p] "r" (__p)
+            : "rax", "memory", "cc"
+            : abort, full);
+        return 0;
+    abort:
+        return -1;
+    full:
+        return 1;
+    }
+
+    //  从__cpu号CPU的缓存中弹出一个对象放到*__out，返回值与_rseq_push相同，1表示栈空
+    static int _rseq_pop(_RseqArea* __rs, int __cpu, size_t* __count, void** __slots, void** __out)
+    {
+        asm goto (
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %[rseq_cs]\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %[cpu_id]\n\t"
+            "jnz 4f\n\t"
+            "movq (%[count]), %%rax\n\t"
+            "testq %%rax, %%rax\n\t"
+            "jz %l[empty]\n\t"
+            "movq -8(%[slots], %%rax, 8), %%rcx\n\t"
+            "movq %%rcx, (%[out])\n\t"
+            "subq $1, %%rax\n\t"
+            "movq %%rax, (%[count])\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[abort]\n\t"
+            ".popsection\n\t"
+            :
+            : [rseq_cs] "m" (__rs->_M_rseq_cs), [cpu_id] "m" (__rs->_M_cpu_id), [cpu] "r" (__cpu),
+              [count] "r" (__count), [slots] "r" (__slots), [out] "r" (__out)
+            : "rax", "rcx", "memory", "cc"
+            : abort, empty);
+        return 0;
+    abort:
+        return -1;
+    empty:
+        return 1;
+    }
+
+    //  从当前CPU的缓存中取一个对象，缓存为空时从arena补充，rseq不可用时返回false
+    static bool _cpu_allocate(_ThreadCache& __tc, size_t __index, void*& __result)
+    {
+        _RseqArea* __rs = _rseq();
+        for (;;)
+        {
+            _CpuCache* __c;
+            int __cpu = _cpu_current(__rs, __c);
+            if (__cpu < 0)
+            {
+                return false;
+            }
+            int __r = _rseq_pop(__rs, __cpu, &__c->_M_count[__index], __c->_M_slots[__index], &__result);
+            if (__r == 0)
+            {
+                return true;
+            }
+            if (__r > 0)
+            {
+                __result = _cpu_refill(__tc, __index);
+                return true;
+            }
+        }
+    }
+
+    //  当前CPU的缓存为空：从arena取一批对象，不够时从内存池切分，
+    //  第一个返回给调用者，其余压入当前CPU的缓存
+    static void* _cpu_refill(_ThreadCache& __tc, size_t __index)
+    {
+        size_t __size = _class_size(__index);
+        size_t __want = _tcache_limit(__index) / 2;
+        void* __batch[__TCACHE_MAX];
+        size_t __n = 0;
+        int __node = _tcache_node(__tc);
+        _Arena& __a = _arenas[__node];
+        while (__n < __want)
+        {
+            _Obj* __p = __a._M_free_list[__index].pop();
+            if (__p == 0)
+            {
+                break;
+            }
+            __batch[__n++] = __p;
+        }
+        if (__n == 0)
+        {
+            std::unique_lock<std::mutex> __lock(__a._M_mtx);
+            size_t __heap = __a._M_heap_size;
+            int __nobjs = std::min(_refill_batch(__a, __index), (int)__want + 1);
+            char* __chunk = _chunk_alloc(__a, __node, __size, __nobjs);
+            __a._M_carved_bytes[__index] += __size * __nobjs;
+            __a._M_objects[__index] += __nobjs;
+            __heap = __a._M_heap_size - __heap;
+            __lock.unlock();
+            if (__heap != 0)
+            {
+                __malloc_alloc_template::note_growth(__heap);
+            }
+            for (; __n < (size_t)__nobjs; __n++)
+            {
+                __batch[__n] = __chunk + __n * __size;
+            }
+        }
+        _cpu_push_all(__tc, __index, __batch + 1, __n - 1);
+        return __batch[0];
+    }
+
+    //  把__n个对象压入当前CPU的缓存，放不下的还给arena
+    static void _cpu_push_all(_ThreadCache& __tc, size_t __index, void** __p, size_t __n)
+    {
+        _RseqArea* __rs = _rseq();
+        size_t __cap = _tcache_limit(__index);
+        while (__n != 0)
+        {
+            _CpuCache* __c;
+            int __cpu = _cpu_current(__rs, __c);
+            if (__cpu < 0)
+            {
+                break;
+            }
+            int __r = _rseq_push(__rs, __cpu, &__c->_M_count[__index], __c->_M_slots[__index], __cap, __p[__n - 1]);
+            if (__r > 0)
+            {
+                break;
+            }
+            if (__r == 0)
+            {
+                __n--;
+            }
+        }
+        for (; __n != 0; __n--)
+        {
+            _Obj* __q = (_Obj*)__p[__n - 1];
+            _arenas[_owner_node(__tc, __q)]._M_free_list[__index].push(__q, __q);
+        }
+    }
+
+    //  把对象放回当前CPU的缓存，缓存满时弹出一半，连同__p串成一段压回arena
+    //  rseq不可用时返回false
+    static bool _cpu_deallocate(_ThreadCache& __tc, size_t __index, void* __p)
+    {
+        _RseqArea* __rs = _rseq();
+        size_t __cap = _tcache_limit(__index);
+        for (;;)
+        {
+            _CpuCache* __c;
+            int __cpu = _cpu_current(__rs, __c);
+            if (__cpu < 0)
+            {
+                return false;
+            }
+            int __r = _rseq_push(__rs, __cpu, &__c->_M_count[__index], __c->_M_slots[__index], __cap, __p);
+            if (__r == 0)
+            {
+                return true;
+            }
+            if (__r > 0)
+            {
+                _Obj* __first = (_Obj*)__p;
+                _Obj* __last = __first;
+                __last->_M_free_list_link = 0;
+                _cpu_pop_list(__rs, __cpu, __c, __index, __cap / 2, __first);
+                _arenas[_owner_node(__tc, __p)]._M_free_list[__index].push(__first, __last);
+                return true;
+            }
+        }
+    }
+
+    //  从__cpu号CPU的缓存中弹出最多__n个对象，串在__first前面；被打断时提前结束
+    static void _cpu_pop_list(_RseqArea* __rs, int __cpu, _CpuCache* __c, size_t __index,
+                              size_t __n, _Obj*& __first)
+    {
+        for (size_t __i = 0; __i < __n; __i++)
+        {
+            void* __q;
+            if (_rseq_pop(__rs, __cpu, &__c->_M_count[__index], __c->_M_slots[__index], &__q) != 0)
+            {
+                break;
+            }
+            ((_Obj*)__q)->_M_free_list_link = __first;
+            __first = (_Obj*)__q;
+        }
+    }
+
+    //  把当前CPU缓存中的对象全部还给arena
+    static void _cpu_drain(_ThreadCache& __tc)
+    {
+        _RseqArea* __rs = _rseq();
+        _CpuCache* __c;
+        int __cpu = _cpu_current(__rs, __c);
+        if (__cpu < 0)
+        {
+            return;
+        }
+        for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+        {
+            _Obj* __first = 0;
+            _cpu_pop_list(__rs, __cpu, __c, __i, __TCACHE_MAX, __first);
+            while (__first != 0)
+            {
+                _Obj* __next = __first->_M_free_list_link;
+                _arenas[_owner_node(__tc, __first)]._M_free_list[__i].push(__first, __first);
+                __first = __next;
+            }
+        }
+    }
+
+    //  把所有CPU缓存中的对象还给arena，trim之前调用
+    //  一个CPU的缓存只能在那个CPU上用rseq操作：依次把本线程绑定到每个已经有缓存的CPU上清空，最后恢复原来的绑定
+    //  本线程不允许运行的CPU(被cpuset排除或已经下线)无法清空，那里缓存的对象所在的chunk这次不会被释放
+    static void _cpu_drain_all(_ThreadCache& __tc)
+    {
+        cpu_set_t __saved;
+        if (sched_getaffinity(0, sizeof(__saved), &__saved) == 0)
+        {
+            for (int __cpu = 0; __cpu < (int)__MAX_CPUS && __cpu < CPU_SETSIZE; __cpu++)
+            {
+                if (__atomic_load_n(&_cpu_caches[__cpu], __ATOMIC_ACQUIRE) == 0)
+                {
+                    continue;
+                }
+                cpu_set_t __one;
+                CPU_ZERO(&__one);
+                CPU_SET(__cpu, &__one);
+                //  绑定之后内核在返回前就把本线程迁移过去了
+                if (sched_setaffinity(0, sizeof(__one), &__one) == 0)
+                {
+                    _cpu_drain(__tc);
+                }
+            }
+            sched_setaffinity(0, sizeof(__saved), &__saved);
+        }
+        _cpu_drain(__tc);
+    }
+#endif
+
+    //  决定这次从内存池切分的对象个数，调用者需要持有__a._M_mtx
+    //  热的大小类像TCP慢启动一样翻倍，直到本线程缓存能容纳的上限，切分的次数越来越少；
+    //  冷的大小类逐步减半，不会再把一大批对象囤积在没有人使用的自由链表上
+    static int _refill_batch(_Arena& __a, size_t __index)
+    {
+        size_t __tick = ++__a._M_tick;
+        size_t __gap = __tick - __a._M_refill_last[__index];
+        size_t& __batch = __a._M_refill_batch[__index];
+        __a._M_refill_last[__index] = __tick;
+        __a._M_refills[__index]++;
+
+        if (__batch == 0)
+        {
+            __batch = __REFILL_INIT;
+        }
+        else if (__gap <= (size_t)__REFILL_HOT_GAP)
+        {
+            __batch *= 2;
+        }
+        else if (__gap >= (size_t)__REFILL_COLD_GAP)
+        {
+            __batch /= 2;
+        }
+
+        size_t __max = _tcache_limit(__index);
+        if (__batch > __max)
+        {
+            __batch = __max;
+        }
+        if (__batch < (size_t)__REFILL_MIN)
+        {
+            __batch = __REFILL_MIN;
+        }
+        return (int)__batch;
+    }
+
+    //  决定这次向region申请chunk时，在两倍请求量之外额外多要的字节数，调用者需要持有__a._M_mtx
+    //  频繁需要新chunk说明arena正在增长，额外部分翻倍；很久才需要一次说明增长已经停止，额外部分减半
+    static size_t _chunk_growth(_Arena& __a)
+    {
+        size_t __gap = __a._M_tick - __a._M_chunk_last;
+        __a._M_chunk_last = __a._M_tick;
+
+        if (__a._M_chunk_grow == 0)
+        {
+            __a._M_chunk_grow = __CHUNK_GROW_MIN;
+        }
+        else if (__gap <= (size_t)__CHUNK_HOT_GAP && __a._M_chunk_grow < (size_t)__CHUNK_GROW_MAX)
+        {
+            __a._M_chunk_grow *= 2;
+        }
+        else if (__gap >= (size_t)__CHUNK_COLD_GAP && __a._M_chunk_grow > (size_t)__CHUNK_GROW_MIN)
+        {
+            __a._M_chunk_grow /= 2;
+        }
+        return __a._M_chunk_grow;
+    }
+
+    //  从内存池切下一段对象，第一个返回给调用者，其余的作为本线程新的span
+    //  不把它们串成链表，用不到的对象就不会被访问；调用者需要持有__a._M_mtx
+    static void* _refill(_Arena& __a, int __node, size_t __n)
+    {
+        size_t __index = _freelist_index(__n);
+        //  每次填充的对象个数由自适应控制器决定
+        int __nobjs = _refill_batch(__a, __index);
+        //  从内存池中获取一块大内存
+        char *__chunk = _chunk_alloc(__a, __node, __n, __nobjs);
+
+        __a._M_carved_bytes[__index] += __n * __nobjs;
+        __a._M_objects[__index] += __nobjs;
+
+        _ThreadCache& __tc = _tcache;
+        __tc._M_span_cur[__index] = __chunk + __n;
+        __tc._M_span_end[__index] = __chunk + __n * __nobjs;
+        __tc._M_span_zero[__index] = __a._M_zero_free;
+        return (__chunk);
+    }
+
+    //  把本线程span中还没有切分的对象串起来还给它们所属的arena，
+    //  线程退出和trim之前调用，否则这部分内存不会被看作空闲
+    static void _span_release(_ThreadCache& __tc, size_t __index)
+    {
+        char* __cur = __tc._M_span_cur[__index];
+        char* __end = __tc._M_span_end[__index];
+        if (__cur == __end)
+        {
+            return;
+        }
+        size_t __size = _class_size(__index);
+        _Obj* __first = (_Obj*)__cur;
+        _Obj* __last = __first;
+        for (__cur += __size; __cur != __end; __cur += __size)
+        {
+            __last->_M_free_list_link = (_Obj*)__cur;
+            __last = (_Obj*)__cur;
+        }
+        __last->_M_free_list_link = 0;
+        _arenas[_owner_node(__tc, __first)]._M_free_list[__index].push(__first, __last);
+        __tc._M_span_cur[__index] = __tc._M_span_end[__index] = 0;
+    }
+
+    //  在堆中分配一块大小为 n 的内存，返回起始地址
+    //  为了提高效率，每次分配的内存大小为 nobjs * n
+    //  调用者需要持有__a._M_mtx，内存不足、调用回收函数期间会暂时放开
+    static char* _chunk_alloc(_Arena& __a, int __node, size_t __size, int& __nobjs)
+    {
+        //  用于保存返回值
+        char* __result;
+        size_t __index = _freelist_index(__size);
+        //  当前位置所在的页已经属于别的大小类时，先把这一页填满
+        _claim_page(__a, __index);
+        //  请求分配的总字节数
+        size_t __total_bytes = __size * __nobjs;
+        //  内存池中剩余的字节数
+        size_t __bytes_left = __a._M_end_free - __a._M_start_free;
+        //  起点先对齐到这个大小类的自然对齐，跳过的几个字节不再使用
+        size_t __pad = (size_t)(0 - (uintptr_t)__a._M_start_free) & (_class_align(__index) - 1);
+        if (__pad != 0 && __bytes_left >= __pad + __size)
+        {
+            _discard(__a, __a._M_start_free, __a._M_start_free + __pad);
+            __a._M_start_free += __pad;
+            __bytes_left -= __pad;
+        }
+
+        //  内存池中剩余空间足够，直接从内存池中分配
+        if (__bytes_left >= __total_bytes)
+        {
+            //  返回内存池中可用空间的起始地址
+            __result = __a._M_start_free;
+            //  更新内存池起始地址
+            __a._M_start_free += __total_bytes;
+            _mark_pages(__result, __size, __nobjs, __index);
+            return(__result);
+        }
+            //  内存池中剩余空间不足以满足请求，但可以分配至少一个对象
+        else if (__bytes_left >= __size)
+        {
+            //  计算可以分配的对象数
+            __nobjs = (int)(__bytes_left / __size);
+            //  重新计算分配的总字节数
+            __total_bytes = __size * __nobjs;
+            //  返回内存池中可用空间的起始地址
+            __result = __a._M_start_free;
+            //  更新内存池起始地址
+            __a._M_start_free += __total_bytes;
+            _mark_pages(__result, __size, __nobjs, __index);
+            return(__result);
+        }
+            //  内存池中剩余空间不足以分配一个对象，需要向系统申请内存
+        else
+        {
+            //  计算需要向系统申请多少字节的内存
+            size_t __bytes_to_get = 2 * __total_bytes + _chunk_growth(__a);
+            //  将内存池中剩余空间加入对应的 free list 中，这是对剩余小块内存重新利用
+            _stash(__a);
+            //  chunk从region中切出，不能跨越region
+            if (__bytes_to_get > (size_t)__region_alloc::__REGION_SIZE - sizeof(_Chunk))
+            {
+                __bytes_to_get = (size_t)__region_alloc::__REGION_SIZE - sizeof(_Chunk);
+            }
+            //  优先复用被trim还给系统的chunk，它的地址空间还在，访问时内核会重新分配物理页
+            _Chunk* __chunk = _chunk_reuse(__a, __bytes_to_get);
+            bool __zero = __chunk == 0;
+            if (__chunk == 0)
+            {
+                //  从region中切出一块，当前region剩下的空间只要够这次请求就先用完它
+                //  头部留给chunk的记录
+                size_t __got = 0;
+                void* __mem = __region_alloc::allocate(__a._M_regions, __node, sizeof(_Chunk) + __total_bytes,
+                                                       sizeof(_Chunk) + __bytes_to_get, __got);
+                //  所有对象都要在region中才能由page map找到大小类，映射失败时不退回malloc，
+                //  而是调用一级配置器的回收函数后重试，什么都回收不了时抛出bad_alloc
+                //  回收函数(比如trim)需要锁住所有arena，所以先放开锁，回来之后内存池可能已经被其他线程补充，从头开始
+                if (__mem == nullptr)
+                {
+                    __a._M_mtx.unlock();
+                    try
+                    {
+                        __malloc_alloc_template::handle_oom(sizeof(_Chunk) + __total_bytes);
+                    }
+                    catch (...)
+                    {
+                        __a._M_mtx.lock();
+                        throw;
+                    }
+                    __a._M_mtx.lock();
+                    return(_chunk_alloc(__a, __node, __size, __nobjs));
+                }
+                __bytes_to_get = __got - sizeof(_Chunk);
+                __chunk = _chunk_register(__a, __mem, __bytes_to_get);
+            }
+            __a._M_heap_size += __chunk->_M_size;
+            if (__a._M_heap_size > __a._M_heap_peak)
+            {
+                __a._M_heap_peak = __a._M_heap_size;
+            }
+            __a._M_start_free = __chunk->_begin();
+            __a._M_end_free = __chunk->_end();
+            __a._M_pool_chunk = __chunk;
+            __a._M_zero_free = __zero;
+            return(_chunk_alloc(__a, __node, __size, __nobjs));
+        }
+    }
+
+    //  在page map中记下从__p开始的__nobjs个对象所在的页，它们属于第__index个大小类，由本线程切分
+    static void _mark_pages(char* __p, size_t __size, int __nobjs, size_t __index)
+    {
+        __region_alloc::set_pages(__p, __p + __size * (__nobjs - 1) + 1, _tcache._M_owner, (int)__index);
+    }
+
+    //  内存池中[__from, __to)这段不会再被切分，记到所在chunk的_M_waste上，调用者需要持有__a._M_mtx
+    //  否则chunk中的空闲字节永远凑不满它的大小，trim不会释放它
+    static void _discard(_Arena& __a, char* __from, char* __to)
+    {
+        if (__from != __to)
+        {
+            __a._M_pool_chunk->_M_waste += __to - __from;
+        }
+    }
+
+    //  一页上开始的对象必须属于同一个大小类，page map才能由地址找到大小类
+    //  内存池当前位置所在的页已经属于别的大小类时，用那个大小类的对象填满这一页的剩余部分，
+    //  挂到自由链表上，下一个大小类从新的一页开始；内存池放不下时剩余空间作废
+    //  调用者需要持有__a._M_mtx
+    static void _claim_page(_Arena& __a, size_t __index)
+    {
+        char* __cur = __a._M_start_free;
+        uint16_t __owner;
+        int __cls;
+        if (__cur == __a._M_end_free || !__region_alloc::page_info(__cur, __owner, __cls)
+            || __cls < 0 || (size_t)__cls == __index)
+        {
+            return;
+        }
+        uintptr_t __page = (uintptr_t)1 << __region_alloc::__PAGE_SHIFT;
+        char* __boundary = (char*)(((uintptr_t)__cur + __page - 1) & ~(__page - 1));
+        size_t __size = _class_size(__cls);
+        char* __aligned = (char*)(((uintptr_t)__cur + _class_align(__cls) - 1) & ~((uintptr_t)_class_align(__cls) - 1));
+        _discard(__a, __cur, std::min(__aligned, __a._M_end_free));
+        __cur = __aligned;
+        while (__cur < __boundary && __cur + __size <= __a._M_end_free)
+        {
+            __a._M_free_list[__cls].push((_Obj*)__cur, (_Obj*)__cur);
+            __a._M_objects[__cls]++;
+            __a._M_carved_bytes[__cls] += __size;
+            __cur += __size;
+        }
+        if (__cur < __boundary)
+        {
+            _discard(__a, std::min(__cur, __a._M_end_free), __a._M_end_free);
+            __cur = __a._M_end_free;
+        }
+        __a._M_start_free = __cur;
+    }
+
+    //  把内存池剩下的空间切成对象挂到自由链表上，调用者需要持有__a._M_mtx
+    //  大小类沿用所在页的大小类，所在页还没有使用时取不超过剩余空间、并且当前地址满足其对齐的最大大小类
+    //  余下不够一个对象的部分作废
+    static void _stash(_Arena& __a)
+    {
+        char* __cur = __a._M_start_free;
+        char* __end = __a._M_end_free;
+        size_t __bytes = __end - __cur;
+        uint16_t __owner;
+        int __cls;
+        __a._M_start_free = __end;
+        if (__bytes < (size_t)__ALIGN || !__region_alloc::page_info(__cur, __owner, __cls))
+        {
+            _discard(__a, __cur, __end);
+            return;
+        }
+        size_t __index;
+        if (__cls >= 0)
+        {
+            __index = __cls;
+            uintptr_t __align = _class_align(__index);
+            char* __aligned = (char*)(((uintptr_t)__cur + __align - 1) & ~(__align - 1));
+            if (__aligned >= __end)
+            {
+                _discard(__a, __cur, __end);
+                return;
+            }
+            _discard(__a, __cur, __aligned);
+            __bytes -= __aligned - __cur;
+            __cur = __aligned;
+        }
+        else
+        {
+            __index = _freelist_index(__bytes);
+            while (_class_size(__index) > __bytes || ((uintptr_t)__cur & (_class_align(__index) - 1)) != 0)
+            {
+                __index--;
+            }
+        }
+        size_t __size = _class_size(__index);
+        int __nobjs = (int)(__bytes / __size);
+        _discard(__a, __cur + __size * __nobjs, __end);
+        if (__nobjs == 0)
+        {
+            return;
+        }
+        for (int __i = 0; __i < __nobjs; __i++)
+        {
+            _Obj* __p = (_Obj*)(__cur + __i * __size);
+            __a._M_free_list[__index].push(__p, __p);
+        }
+        __a._M_objects[__index] += __nobjs;
+        __a._M_carved_bytes[__index] += __size * __nobjs;
+        _mark_pages(__cur, __size, __nobjs, __index);
+    }
+
+    //  把新申请到的内存记录为arena的一个chunk，调用者需要持有__a._M_mtx
+    static _Chunk* _chunk_register(_Arena& __a, void* __mem, size_t __bytes)
+    {
+        _Chunk* __chunk = (_Chunk*)__mem;
+        __chunk->_M_size = __bytes;
+        __chunk->_M_free = 0;
+        __chunk->_M_waste = 0;
+        __chunk->_M_released = 0;
+        __chunk->_M_next = __a._M_chunk_list;
+        __a._M_chunk_list = __chunk;
+        __a._M_chunk_count++;
+        return __chunk;
+    }
+
+    //  在arena中找一个已经被trim释放、大小足够的chunk重新使用，没有时返回0，调用者需要持有__a._M_mtx
+    static _Chunk* _chunk_reuse(_Arena& __a, size_t __bytes)
+    {
+        for (_Chunk* __chunk = __a._M_chunk_list; __chunk != 0; __chunk = __chunk->_M_next)
+        {
+            if (__chunk->_M_released && __chunk->_M_size >= __bytes)
+            {
+                __chunk->_M_released = 0;
+                __chunk->_M_waste = 0;
+                return __chunk;
+            }
+        }
+        return 0;
+    }
+
+    //  在按地址排好序的chunk数组中二分查找__p所在的chunk
+    static _Chunk* _chunk_find(_Chunk** __chunks, size_t __n, void* __p)
+    {
+        _Chunk** __it = std::upper_bound(__chunks, __chunks + __n, (_Chunk*)__p);
+        return *(__it - 1);
+    }
+
+    //  trim统计之后，chunk中没有正在使用的对象，可以释放
+    static bool _chunk_idle(const _Chunk* __chunk)
+    {
+        return !__chunk->_M_released && __chunk->_M_free + __chunk->_M_waste == __chunk->_M_size;
+    }
+
+    //  把chunk中除头部所在页之外的整页交还给系统
+    //  这里不用free：其他线程的无锁pop可能还会读取这块内存中旧结点的next，
+    //  madvise之后地址仍然有效(读到的是0)，CAS会因为版本号改变而失败
+    static size_t _chunk_release(_Chunk* __chunk)
+    {
+        uintptr_t __page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t __first = ((uintptr_t)__chunk->_begin() + __page - 1) & ~(__page - 1);
+        uintptr_t __last = (uintptr_t)__chunk->_end() & ~(__page - 1);
+        __chunk->_M_released = 1;
+        //  释放的页上已经没有对象，清除page map中的记录
+        if (__first < __last)
+        {
+            __region_alloc::set_pages((void*)__first, (void*)__last, 0, -1);
+        }
+        //  用MAP_HUGETLB映射的大页不能按普通页释放，madvise会失败，此时不计入释放的字节数
+        if (__first >= __last || madvise((void*)__first, __last - __first, MADV_DONTNEED) != 0)
+        {
+            return 0;
+        }
+        return __last - __first;
+    }
+
+    //  本线程所在的结点，第一次调用和每填充__NODE_RECHECK次缓存后重新查询
+    static int _tcache_node(_ThreadCache& __tc)
+    {
+        if (__tc._M_node < 0 || ++__tc._M_fills % __NODE_RECHECK == 0)
+        {
+            __tc._M_node = __region_alloc::current_node();
+        }
+        return __tc._M_node;
+    }
+
+    //  __p属于哪个arena：由它所在region的结点决定，不在region中时交给本线程的arena
+    static int _owner_node(_ThreadCache& __tc, void* __p)
+    {
+        int __node = __region_alloc::node_of(__p);
+        return __node < 0 ? _tcache_node(__tc) : __node;
+    }
+
+    //  释放一个由__owner号线程切分出来的对象：先攒在本线程，攒够一批或者遇到别的所有者时整段压入
+    static void _remote_free(_ThreadCache& __tc, uint16_t __owner, size_t __index, _Obj* __p)
+    {
+        if (__tc._M_remote_owner[__index] != __owner)
+        {
+            _remote_flush(__tc, __index);
+            __tc._M_remote_owner[__index] = __owner;
+            __tc._M_remote_last[__index] = __p;
+        }
+        __p->_M_free_list_link = __tc._M_remote_first[__index];
+        __tc._M_remote_first[__index] = __p;
+        if (++__tc._M_remote_count[__index] >= (size_t)__REMOTE_BATCH)
+        {
+            _remote_flush(__tc, __index);
+        }
+    }
+
+    //  把本线程攒下的第__index类对象用一次CAS压入所有者的远程队列
+    static void _remote_flush(_ThreadCache& __tc, size_t __index)
+    {
+        if (__tc._M_remote_count[__index] == 0)
+        {
+            return;
+        }
+        uint16_t __owner = __tc._M_remote_owner[__index];
+        _Obj** __head = &_remote[__owner][__index];
+        _Obj* __last = __tc._M_remote_last[__index];
+        _Obj* __old = __atomic_load_n(__head, __ATOMIC_RELAXED);
+        do
+        {
+            __last->_M_free_list_link = __old;
+        } while (!__atomic_compare_exchange_n(__head, &__old, __tc._M_remote_first[__index], true,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        //  这里先写队列再读标记位，trim先清标记位再读队列，是两个地址上的"先写后读"：
+        //  没有全序栅栏时两边可能都读到旧值(x86上CAS带lock前缀碰巧成立，ARM/POWER上不成立)，
+        //  本线程读到已经置位而跳过，trim却在清零之后看不到刚压入的对象，它们直到所有者自己取走之前都不会被trim看到
+        //  两边各放一个seq_cst栅栏，至少有一边能看到对方的写：要么这里看到位已清零而重新置位，要么trim取到这批对象
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        //  已经置位时不再写，避免释放频繁的线程之间争用同一个字
+        uint64_t* __word = &_remote_pending[__owner / 64];
+        uint64_t __bit = (uint64_t)1 << (__owner % 64);
+        if ((__atomic_load_n(__word, __ATOMIC_RELAXED) & __bit) == 0)
+        {
+            __atomic_fetch_or(__word, __bit, __ATOMIC_RELEASE);
+        }
+        __tc._M_remote_first[__index] = 0;
+        __tc._M_remote_last[__index] = 0;
+        __tc._M_remote_count[__index] = 0;
+        __tc._M_remote_owner[__index] = 0;
+    }
+
+    //  取走__owner号远程队列中第__index类的全部对象，挂到__tc的缓存上，返回取到的个数
+    //  缓存超过上限时把多出来的部分归还给arena
+    static size_t _remote_take(_ThreadCache& __tc, uint16_t __owner, size_t __index)
+    {
+        _Obj** __head = &_remote[__owner][__index];
+        if (__owner == 0 || __atomic_load_n(__head, __ATOMIC_RELAXED) == 0)
+        {
+            return 0;
+        }
+        _Obj* __first = __atomic_exchange_n(__head, (_Obj*)0, __ATOMIC_ACQUIRE);
+        if (__first == 0)
+        {
+            return 0;
+        }
+        _Obj* __last = __first;
+        size_t __k = 1;
+        for (; __last->_M_free_list_link != 0; __last = __last->_M_free_list_link)
+        {
+            __k++;
+        }
+        __last->_M_free_list_link = __tc._M_list[__index];
+        __tc._M_list[__index] = __first;
+        __tc._M_count[__index] += __k;
+        size_t __limit = _tcache_limit(__index);
+        if (__tc._M_count[__index] > __limit)
+        {
+            _tcache_flush(__tc, __index, __tc._M_count[__index] - __limit / 2);
+        }
+        return __k;
+    }
+
+    //  本线程缓存为空时调用：从本结点arena的无锁自由链表批量取出对象放入本线程缓存，
+    //  自由链表也为空时再加锁调用_refill从内存池切分新的对象
+    static void* _tcache_fill(_ThreadCache& __tc, size_t __n)
+    {
+        size_t __index = _freelist_index(__n);
+        //  先取回其他线程释放给本线程的对象
+        if (_remote_take(__tc, __tc._M_owner, __index) != 0)
+        {
+            _Obj* __p = __tc._M_list[__index];
+            __tc._M_list[__index] = __p->_M_free_list_link;
+            __tc._M_count[__index]--;
+            return __p;
+        }
+        int __node = _tcache_node(__tc);
+        _Arena& __a = _arenas[__node];
+        _LockFreeList& __list = __a._M_free_list[__index];
+
+        _Obj* __result = __list.pop();
+        if (__result == 0)
+        {
+            //  慢路径：加锁后再检查一次，可能其他线程已经把对象归还到了自由链表
+            std::unique_lock<std::mutex> __lock(__a._M_mtx);
+            __result = __list.pop();
+            if (__result == 0)
+            {
+                size_t __heap = __a._M_heap_size;
+                __result = (_Obj*)_refill(__a, __node, __n);
+                //  内存池向系统要了新的chunk，放开锁之后检查RSS是否超过上限
+                __heap = __a._M_heap_size - __heap;
+                __lock.unlock();
+                if (__heap != 0)
+                {
+                    __malloc_alloc_template::note_growth(__heap);
+                }
+                return __result;
+            }
+        }
+
+        //  第一个对象返回给调用者，之后再取四分之一缓存上限的对象挪到本线程缓存
+        size_t __batch = _tcache_limit(__index) / 4;
+        for (size_t __i = 1; __i < __batch; __i++)
+        {
+            _Obj* __p = __list.pop();
+            if (__p == 0)
+            {
+                break;
+            }
+            __p->_M_free_list_link = __tc._M_list[__index];
+            __tc._M_list[__index] = __p;
+            __tc._M_count[__index]++;
+        }
+        return __result;
+    }
+
+    //  把本线程缓存中第__index条链表头部的__nobjs个对象一次性归还给arena的自由链表
+    //  单结点时找到这一段链表的尾部，用一次CAS整段压入；
+    //  多结点时按对象所属的结点分成几段，分别压回各自的arena，内存不会在结点之间漂移
+    static void _tcache_flush(_ThreadCache& __tc, size_t __index, size_t __nobjs)
+    {
+        _Obj* __first = __tc._M_list[__index];
+        _Obj* __last = __first;
+        for (size_t __i = 1; __i < __nobjs; __i++)
+        {
+            __last = __last->_M_free_list_link;
+        }
+        __tc._M_list[__index] = __last->_M_free_list_link;
+        __tc._M_count[__index] -= __nobjs;
+
+        if (__region_alloc::node_count() == 1)
+        {
+            _arenas[0]._M_free_list[__index].push(__first, __last);
+            return;
+        }
+
+        _Obj* __heads[__region_alloc::__MAX_NODES] = { 0 };
+        _Obj* __tails[__region_alloc::__MAX_NODES] = { 0 };
+        __last->_M_free_list_link = 0;
+        _Obj* __next;
+        for (_Obj* __p = __first; __p != 0; __p = __next)
+        {
+            __next = __p->_M_free_list_link;
+            int __node = _owner_node(__tc, __p);
+            __p->_M_free_list_link = __heads[__node];
+            __heads[__node] = __p;
+            if (__tails[__node] == 0)
+            {
+                __tails[__node] = __p;
+            }
+        }
+        for (int __node = 0; __node < (int)__region_alloc::__MAX_NODES; __node++)
+        {
+            if (__heads[__node] != 0)
+            {
+                _arenas[__node]._M_free_list[__index].push(__heads[__node], __tails[__node]);
+            }
+        }
+    }
+
+    //  释放的指针不是本配置器分配的，或者传入的大小超过了对象所在的大小类：
+    //  继续执行会破坏自由链表，直接终止程序
+    static void _invalid_free(const void* __p, size_t __n)
+    {
+        char __buf[128];
+        int __len = snprintf(__buf, sizeof(__buf),
+                             "__default_alloc_base: invalid free of %p (size %zu)\n", __p, __n);
+        ssize_t __written = write(STDERR_FILENO, __buf, __len);
+        (void)__written;
+        abort();
+    }
+
+    //  allocate和deallocate的实际实现，reallocate也用它们，不会重复记录
+    static void* _allocate(size_t __n)
+    {
+        //  如果申请的内存空间超过了__MAX_BYTES（32KB），使用第一级配置器
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            return __malloc_alloc_template::allocate(__n);
+        }
+        //  如果申请的内存空间小于等于_MAX_BYTES（32KB），使用第二级配置器
+        return _allocate_class(_freelist_index(__n));
+    }
+
+    //  线程缓存已经析构时的分配：加锁从arena的自由链表取，没有时从内存池切分一个对象
+    static void* _arena_allocate(_ThreadCache& __tc, size_t __index)
+    {
+        int __node = _tcache_node(__tc);
+        _Arena& __a = _arenas[__node];
+        std::unique_lock<std::mutex> __lock(__a._M_mtx);
+        _Obj* __result = __a._M_free_list[__index].pop();
+        if (__result != 0)
+        {
+            return __result;
+        }
+        size_t __heap = __a._M_heap_size;
+        size_t __size = _class_size(__index);
+        int __nobjs = 1;
+        char* __chunk = _chunk_alloc(__a, __node, __size, __nobjs);
+        __a._M_carved_bytes[__index] += __size;
+        __a._M_objects[__index]++;
+        __heap = __a._M_heap_size - __heap;
+        __lock.unlock();
+        if (__heap != 0)
+        {
+            __malloc_alloc_template::note_growth(__heap);
+        }
+        return __chunk;
+    }
+
+    //  线程缓存已经析构时的释放：直接压回对象所属arena的自由链表
+    static void _arena_deallocate(_ThreadCache& __tc, size_t __index, _Obj* __p)
+    {
+        _arenas[_owner_node(__tc, __p)]._M_free_list[__index].push(__p, __p);
+    }
+
+    //  从第__index个大小类分配一个对象
+    static void* _allocate_class(size_t __index)
+    {
+        //  先从本线程缓存中取，命中时不需要加锁
+        _ThreadCache& __tc = _tcache;
+        if (__tc._M_dead)
+        {
+            return _arena_allocate(__tc, __index);
+        }
+        _count(__tc._M_allocs[__index]);
+#ifdef __ALLOC_HAS_RSEQ
+        void* __cpu_result;
+        if (_cpu_allocate(__tc, __index, __cpu_result))
+        {
+            return __cpu_result;
+        }
+#endif
+        _Obj* __result = __tc._M_list[__index];
+        if (__result != 0)
+        {
+            __tc._M_list[__index] = __result->_M_free_list_link;
+            __tc._M_count[__index]--;
+            return __result;
+        }
+        //  自由链表为空时从本线程的span中切分下一个对象
+        char* __span = __tc._M_span_cur[__index];
+        if (__span != __tc._M_span_end[__index])
+        {
+            __tc._M_span_cur[__index] = __span + _class_size(__index);
+            return __span;
+        }
+        //  本线程缓存为空，批量从全局自由链表或内存池中取
+        return _tcache_fill(__tc, _class_size(__index));
+    }
+
+    static void _deallocate(void* __p, size_t __n)
+    {
+        //  判断内存块大小是否大于阈值_MAX_BYTES
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            uint16_t __owner;
+            int __cls;
+            if (__region_alloc::page_info(__p, __owner, __cls))
+            {
+                _invalid_free(__p, __n);
+            }
+            //  大于阈值，调用一级配置器的deallocate函数释放内存
+            __malloc_alloc_template::deallocate(__p);
+            return;
+        }
+        _deallocate_class(__p, _freelist_index(__n), __n);
+    }
+
+    //  释放一个按第__index个大小类申请的对象，__n是调用者传入的大小，只用于报错
+    static void _deallocate_class(void* __p, size_t __index, size_t __n)
+    {
+        //  page map记录了对象所在页的所有者和大小类
+        uint16_t __owner;
+        int __cls;
+        bool __pooled = __region_alloc::page_info(__p, __owner, __cls);
+        //  传入的大小超过了对象所在的大小类，或者不是本配置器分配的对象
+        if (!__pooled || __cls < 0 || __index > (size_t)__cls)
+        {
+            _invalid_free(__p, __n);
+        }
+
+        //  小于等于阈值，先挂到本线程缓存上，大小类以page map中记录的为准
+        _ThreadCache& __tc = _tcache;
+        __index = __cls;
+        _Obj* __q = (_Obj*)__p;
+        if (__tc._M_dead)
+        {
+            _arena_deallocate(__tc, __index, __q);
+            return;
+        }
+        _count(__tc._M_frees[__index]);
+#ifdef __ALLOC_HAS_RSEQ
+        //  有CPU缓存时不区分切分对象的线程，直接放回当前CPU
+        if (_cpu_deallocate(__tc, __index, __p))
+        {
+            return;
+        }
+#endif
+        //  其他线程切分出来的对象放回它的远程释放队列
+        if (__owner != __tc._M_owner && __owner != 0)
+        {
+            _remote_free(__tc, __owner, __index, __q);
+            return;
+        }
+        __q->_M_free_list_link = __tc._M_list[__index];
+        __tc._M_list[__index] = __q;
+
+        //  本线程缓存过满，把多出来的一批对象归还给全局自由链表，供其他线程使用
+        size_t __limit = _tcache_limit(__index);
+        if (++__tc._M_count[__index] > __limit)
+        {
+            _tcache_flush(__tc, __index, __tc._M_count[__index] - __limit / 2);
         }
     }
 
-    //  内容扩充&缩容
     //  重新分配内存，将旧内存中的数据拷贝到新的内存中，同时释放旧内存
-    void *reallocate(void* __p, size_t __old_sz, size_t __new_sz)
+    static void* _reallocate(void* __p, size_t __old_sz, size_t __new_sz)
+    {
+        void* __result;
+        size_t __copy_sz;
+
+        //  如果旧内存和新内存的大小都大于_MAX_BYTES（32KB），则直接调用reallocate函数进行内存重分配
+        if (__old_sz > (size_t)__MAX_BYTES && __new_sz > (size_t)__MAX_BYTES)
+        {
+            return (__malloc_alloc_template::reallocate(__p, __new_sz));
+        }
+
+        //  旧对象所在的大小类由page map给出：新的大小没有变小到更小的大小类、
+        //  也没有超出对象实际所在的大小类时，不需要进行内存操作，直接返回旧内存指针
+        uint16_t __owner;
+        int __cls;
+        if (__old_sz <= (size_t)__MAX_BYTES && __new_sz <= (size_t)__MAX_BYTES
+            && __region_alloc::page_info(__p, __owner, __cls) && __cls >= 0
+            && _freelist_index(__new_sz) >= _freelist_index(__old_sz)
+            && _freelist_index(__new_sz) <= (size_t)__cls)
+        {
+            return (__p);
+        }
+
+        //  如果需要进行内存操作，则先调用allocate函数分配新内存，然后将旧内存中的数据拷贝到新内存中
+        //  分配新内存
+        __result = _allocate(__new_sz);
+        //  计算拷贝大小，取较小值
+        __copy_sz = __new_sz > __old_sz ? __old_sz : __new_sz;
+        //  将旧内存中的数据拷贝到新内存中
+        std::memcpy(__result, __p, __copy_sz);
+
+        //  释放旧内存
+        _deallocate(__p, __old_sz);
+        //  返回新内存首地址
+        return(__result);
+
+    }
+
+    //  allocate_batch的实际实现，对象都属于第__index个大小类
+    static void _allocate_batch(size_t __index, size_t __count, void** __out)
+    {
+        _ThreadCache& __tc = _tcache;
+        size_t __i = 0;
+        if (__tc._M_dead)
+        {
+            try
+            {
+                for (; __i < __count; __i++)
+                {
+                    __out[__i] = _arena_allocate(__tc, __index);
+                }
+            }
+            catch (...)
+            {
+                while (__i > 0)
+                {
+                    _arena_deallocate(__tc, __index, (_Obj*)__out[--__i]);
+                }
+                throw;
+            }
+            return;
+        }
+        __atomic_store_n(&__tc._M_allocs[__index], __tc._M_allocs[__index] + __count, __ATOMIC_RELAXED);
+        size_t __size = _class_size(__index);
+
+        //  先用本线程缓存里的对象，再用本线程span中还没有切分的对象
+        while (__i < __count && __tc._M_list[__index] != 0)
+        {
+            _Obj* __p = __tc._M_list[__index];
+            __tc._M_list[__index] = __p->_M_free_list_link;
+            __tc._M_count[__index]--;
+            __out[__i++] = __p;
+        }
+        while (__i < __count && __tc._M_span_cur[__index] != __tc._M_span_end[__index])
+        {
+            __out[__i++] = __tc._M_span_cur[__index];
+            __tc._M_span_cur[__index] += __size;
+        }
+        if (__i == __count)
+        {
+            return;
+        }
+
+        //  摘下arena的整条自由链表，用不完的部分留在本线程缓存
+        int __node = _tcache_node(__tc);
+        _Arena& __a = _arenas[__node];
+        _Obj* __list = __a._M_free_list[__index].pop_all();
+        while (__i < __count && __list != 0)
+        {
+            __out[__i++] = __list;
+            __list = __list->_M_free_list_link;
+        }
+        if (__list != 0)
+        {
+            _Obj* __last = __list;
+            size_t __k = 1;
+            for (; __last->_M_free_list_link != 0; __last = __last->_M_free_list_link)
+            {
+                __k++;
+            }
+            __last->_M_free_list_link = __tc._M_list[__index];
+            __tc._M_list[__index] = __list;
+            __tc._M_count[__index] += __k;
+            size_t __limit = _tcache_limit(__index);
+            if (__tc._M_count[__index] > __limit)
+            {
+                _tcache_flush(__tc, __index, __tc._M_count[__index] - __limit / 2);
+            }
+            return;
+        }
+
+        //  剩下的从内存池切分，整批只加一次锁
+        //  每次切分不超过region的四分之一，保证_chunk_alloc能从一个region中满足请求
+        size_t __max = ((size_t)__region_alloc::__REGION_SIZE / 4) / __size;
+        std::unique_lock<std::mutex> __lock(__a._M_mtx);
+        size_t __heap = __a._M_heap_size;
+        try
+        {
+            while (__i < __count)
+            {
+                int __nobjs = (int)std::min(__count - __i, __max);
+                char* __chunk = _chunk_alloc(__a, __node, __size, __nobjs);
+                __a._M_carved_bytes[__index] += __size * __nobjs;
+                __a._M_objects[__index] += __nobjs;
+                for (int __k = 0; __k < __nobjs; __k++)
+                {
+                    __out[__i++] = __chunk + __k * __size;
+                }
+            }
+        }
+        catch (...)
+        {
+            //  回收之后仍然申请不到内存，已经拿到的对象还给本线程缓存
+            while (__i > 0)
+            {
+                _deallocate(__out[--__i], __size);
+            }
+            throw;
+        }
+        __heap = __a._M_heap_size - __heap;
+        __lock.unlock();
+        if (__heap != 0)
+        {
+            __malloc_alloc_template::note_growth(__heap);
+        }
+    }
+
+public:
+    //  开辟内存的函数，申请大小为__n的内存空间，返回指向申请内存的指针
+    static void* allocate(size_t __n)
+    {
+        void* __result = _allocate(__n);
+        if (__alloc_trace::enabled())
+        {
+            __alloc_trace::log(__alloc_trace::op_allocate, __result, 0, __n);
+        }
+        return __result;
+    }
+
+    //  释放内存
+    static void deallocate(void* __p, size_t __n)
+    {
+        if (__alloc_trace::enabled())
+        {
+            __alloc_trace::log(__alloc_trace::op_deallocate, __p, 0, __n);
+        }
+        _deallocate(__p, __n);
+    }
+
+    //  大小类下标已知时的allocate/deallocate，__index = size_classes::index(__n)，
+    //  省去每次由大小换算下标；simple_alloc对单个对象在编译期求出下标后调用
+    //  __n是调用者请求的字节数，分配记录器记下它而不是大小类的大小，重放时才能还原请求的大小分布
+    static void* allocate_class(size_t __index, size_t __n)
+    {
+        void* __result = _allocate_class(__index);
+        if (__alloc_trace::enabled())
+        {
+            __alloc_trace::log(__alloc_trace::op_allocate, __result, 0, __n);
+        }
+        return __result;
+    }
+
+    static void deallocate_class(void* __p, size_t __index, size_t __n)
+    {
+        if (__alloc_trace::enabled())
+        {
+            __alloc_trace::log(__alloc_trace::op_deallocate, __p, 0, __n);
+        }
+        _deallocate_class(__p, __index, __n);
+    }
+
+    //  申请__n字节内容全为0的内存，用deallocate释放
+    //  region中的内存都是新映射的，chunk第一次切分时还没有被写过：
+    //  本线程span中还有这样的对象时直接取出，不需要清零；其他对象取出后再清零
+    static void* allocate_zeroed(size_t __n)
+    {
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            void* __big = __malloc_alloc_template::allocate_zeroed(__n);
+            if (__alloc_trace::enabled())
+            {
+                __alloc_trace::log(__alloc_trace::op_allocate, __big, 0, __n);
+            }
+            return __big;
+        }
+        _ThreadCache& __tc = _tcache;
+        size_t __index = _freelist_index(__n);
+        char* __span = __tc._M_span_cur[__index];
+        bool __zero = false;
+        if (__span != __tc._M_span_end[__index] && __tc._M_span_zero[__index])
+        {
+            _count(__tc._M_allocs[__index]);
+            __tc._M_span_cur[__index] = __span + _class_size(__index);
+            __zero = true;
+        }
+        else
+        {
+            //  span已经用完时先清除标记，_allocate_class从新映射的chunk切出新span时会重新设置，
+            //  此时返回的是新span之前的第一个对象，同样还没有被写过
+            if (__span == __tc._M_span_end[__index])
+            {
+                __tc._M_span_zero[__index] = false;
+            }
+            __span = (char*)_allocate_class(__index);
+            __zero = __tc._M_span_zero[__index] && __tc._M_span_cur[__index] == __span + _class_size(__index);
+        }
+        if (!__zero)
+        {
+            std::memset(__span, 0, __n);
+        }
+        if (__alloc_trace::enabled())
+        {
+            __alloc_trace::log(__alloc_trace::op_allocate, __span, 0, __n);
+        }
+        return __span;
+    }
+
+    //  内容扩充&缩容
+    static void *reallocate(void* __p, size_t __old_sz, size_t __new_sz)
+    {
+        //  旧地址要在调用之前取出：之后__p可能已经被realloc释放，不能再使用，
+        //  只转成整数的话编译器仍会把读取挪到调用之后，-Wuse-after-free照样报警
+        const bool __trace = __alloc_trace::enabled();
+        uintptr_t __old_id = __trace ? (uintptr_t)__p : 0;
+        void* __result = _reallocate(__p, __old_sz, __new_sz);
+        if (__trace)
+        {
+            __alloc_trace::log(__alloc_trace::op_reallocate, __result, __old_id, __new_sz);
+        }
+        return __result;
+    }
+
+    //  按__align字节对齐分配__n字节，__align是2的幂
+    //  不超过8字节的对齐与allocate相同；不超过64字节的从满足对齐的最小大小类中取，
+    //  和普通分配共用自由链表和本线程缓存；更大的对齐或者更大的对象交给一级配置器
+    static void* allocate_aligned(size_t __n, size_t __align)
+    {
+        if (__align <= (size_t)__ALIGN)
+        {
+            return allocate(__n);
+        }
+        if (__align > (size_t)__MAX_ALIGN || __n > (size_t)__MAX_BYTES)
+        {
+            return __malloc_alloc_template::allocate_aligned(__n, __align);
+        }
+        return allocate(_class_size(_aligned_index(__n, __align)));
+    }
+
+    //  释放allocate_aligned分配的内存，__n和__align必须与分配时相同
+    static void deallocate_aligned(void* __p, size_t __n, size_t __align)
+    {
+        if (__align <= (size_t)__ALIGN)
+        {
+            deallocate(__p, __n);
+        }
+        else if (__align > (size_t)__MAX_ALIGN || __n > (size_t)__MAX_BYTES)
+        {
+            __malloc_alloc_template::deallocate(__p);
+        }
+        else
+        {
+            deallocate(__p, _class_size(_aligned_index(__n, __align)));
+        }
+    }
+
+    //  一次申请__count个大小为__n的对象，依次写入__out
+    //  先取本线程缓存，不够时用一次原子操作摘下arena的整条自由链表，
+    //  还不够时只加一次锁，从内存池连续切分剩下的个数
+    static void allocate_batch(size_t __n, size_t __count, void** __out)
+    {
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            size_t __i = 0;
+            try
+            {
+                for (; __i < __count; __i++)
+                {
+                    __out[__i] = __malloc_alloc_template::allocate(__n);
+                }
+            }
+            catch (...)
+            {
+                while (__i > 0)
+                {
+                    __malloc_alloc_template::deallocate(__out[--__i]);
+                }
+                throw;
+            }
+        }
+        else
+        {
+            _allocate_batch(_freelist_index(__n), __count, __out);
+        }
+        if (__alloc_trace::enabled())
+        {
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                __alloc_trace::log(__alloc_trace::op_allocate, __out[__i], 0, __n);
+            }
+        }
+    }
+
+    //  一次释放__count个大小为__n的对象
+    //  整批先串起来挂到本线程缓存上，超过上限时多出来的部分用一次CAS整段归还给arena，
+    //  其他线程切分出来的对象和deallocate一样放回它们的远程释放队列
+    static void deallocate_batch(size_t __n, size_t __count, void** __p)
+    {
+        if (__alloc_trace::enabled())
+        {
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                __alloc_trace::log(__alloc_trace::op_deallocate, __p[__i], 0, __n);
+            }
+        }
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                _deallocate(__p[__i], __n);
+            }
+            return;
+        }
+        if (__count == 0)
+        {
+            return;
+        }
+
+        _ThreadCache& __tc = _tcache;
+        if (__tc._M_dead)
+        {
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                _deallocate(__p[__i], __n);
+            }
+            return;
+        }
+        size_t __index = _freelist_index(__n);
+        size_t __local = 0;
+        size_t __other = 0;
+        for (size_t __i = __count; __i > 0; __i--)
+        {
+            _Obj* __q = (_Obj*)__p[__i - 1];
+            uint16_t __owner;
+            int __cls;
+            if (!__region_alloc::page_info(__q, __owner, __cls) || __cls < 0 || __index > (size_t)__cls)
+            {
+                _invalid_free(__q, __n);
+            }
+            //  实际在更大的大小类中(比如按对齐分配的对象)，单独释放
+            if ((size_t)__cls != __index)
+            {
+                _deallocate(__q, _class_size(__cls));
+                __other++;
+                continue;
+            }
+            if (__owner != __tc._M_owner && __owner != 0)
+            {
+                _remote_free(__tc, __owner, __index, __q);
+                continue;
+            }
+            __q->_M_free_list_link = __tc._M_list[__index];
+            __tc._M_list[__index] = __q;
+            __local++;
+        }
+        __atomic_store_n(&__tc._M_frees[__index], __tc._M_frees[__index] + __count - __other, __ATOMIC_RELAXED);
+        __tc._M_count[__index] += __local;
+
+        size_t __limit = _tcache_limit(__index);
+        if (__tc._M_count[__index] > __limit)
+        {
+            _tcache_flush(__tc, __index, __tc._M_count[__index] - __limit / 2);
+        }
+    }
+
+    //  与malloc/free/realloc相同的接口，释放时不需要传入大小：
+    //  内存池中的对象由page map找到大小类，不在region中的是一级配置器分配的大块内存
+    static void* malloc(size_t __n)
+    {
+        return allocate(__n == 0 ? 1 : __n);
+    }
+
+    static void* calloc(size_t __count, size_t __size)
+    {
+        size_t __n;
+        if (__builtin_mul_overflow(__count, __size, &__n))
+        {
+            throw std::bad_alloc();
+        }
+        return allocate_zeroed(__n == 0 ? 1 : __n);
+    }
+
+    static void free(void* __p)
+    {
+        if (__p == 0)
+        {
+            return;
+        }
+        uint16_t __owner;
+        int __cls;
+        if (__region_alloc::page_info(__p, __owner, __cls))
+        {
+            if (__cls < 0)
+            {
+                _invalid_free(__p, 0);
+            }
+            deallocate(__p, _class_size(__cls));
+            return;
+        }
+        if (__alloc_trace::enabled())
+        {
+            __alloc_trace::log(__alloc_trace::op_deallocate, __p, 0, ::malloc_usable_size(__p));
+        }
+        __malloc_alloc_template::deallocate(__p);
+    }
+
+    static void* realloc(void* __p, size_t __n)
+    {
+        if (__p == 0)
+        {
+            return malloc(__n);
+        }
+        if (__n == 0)
+        {
+            free(__p);
+            return 0;
+        }
+        uint16_t __owner;
+        int __cls;
+        if (__region_alloc::page_info(__p, __owner, __cls))
+        {
+            if (__cls < 0)
+            {
+                _invalid_free(__p, 0);
+            }
+            return reallocate(__p, _class_size(__cls), __n);
+        }
+        //  一级配置器的内存：新的大小仍然超过阈值时直接realloc，否则搬到内存池中
+        size_t __old_sz = ::malloc_usable_size(__p);
+        const bool __trace = __alloc_trace::enabled();
+        uintptr_t __old_id = __trace ? (uintptr_t)__p : 0;
+        void* __result;
+        if (__n > (size_t)__MAX_BYTES)
+        {
+            __result = __malloc_alloc_template::reallocate(__p, __n);
+        }
+        else
+        {
+            __result = _allocate(__n);
+            std::memcpy(__result, __p, std::min(__old_sz, __n));
+            __malloc_alloc_template::deallocate(__p);
+        }
+        if (__trace)
+        {
+            __alloc_trace::log(__alloc_trace::op_reallocate, __result, __old_id, __n);
+        }
+        return __result;
+    }
+
+    //  __p实际可用的字节数，与malloc_usable_size相同
+    static size_t usable_size(const void* __p)
+    {
+        if (__p == 0)
+        {
+            return 0;
+        }
+        uint16_t __owner;
+        int __cls;
+        if (__region_alloc::page_info(__p, __owner, __cls))
+        {
+            return __cls < 0 ? 0 : _class_size(__cls);
+        }
+        return ::malloc_usable_size(const_cast<void*>(__p));
+    }
+
+    //  自适应填充控制器中一个大小类的状态
+    struct refill_info
+    {
+        //  大小类的字节数
+        size_t class_size;
+        //  下一次从内存池切分的对象个数，还没有切分过时为0
+        size_t batch;
+        //  已经切分的次数
+        size_t refills;
+    };
+
+    //  查询__node结点的arena中，__bytes所在大小类的自适应填充状态
+    static refill_info refill_state(size_t __bytes, int __node = 0)
+    {
+        refill_info __info = { 0, 0, 0 };
+        if (__bytes == 0 || __bytes > (size_t)__MAX_BYTES)
+        {
+            return __info;
+        }
+        size_t __index = _freelist_index(__bytes);
+        _Arena& __a = _arenas[__node];
+        std::lock_guard<std::mutex> guard(__a._M_mtx);
+        __info.class_size = _class_size(__index);
+        __info.batch = __a._M_refill_batch[__index];
+        __info.refills = __a._M_refills[__index];
+        return __info;
+    }
+
+    //  __node结点的arena下一次向region申请chunk时额外多要的字节数
+    static size_t chunk_growth(int __node = 0)
+    {
+        _Arena& __a = _arenas[__node];
+        std::lock_guard<std::mutex> guard(__a._M_mtx);
+        return __a._M_chunk_grow;
+    }
+
+    //  一个大小类的统计
+    struct class_stats
+    {
+        //  大小类的字节数
+        size_t class_size;
+        //  分配和释放的次数
+        size_t allocations;
+        size_t frees;
+        //  从内存池切分的次数和切分出去的字节数
+        size_t refills;
+        size_t carved_bytes;
+        //  挂在自由链表(包括各线程缓存)上的对象个数
+        size_t free_objects;
+    };
+
+    //  二级配置器的统计信息
+    struct pool_stats
+    {
+        class_stats classes[__NFREELISTS];
+        //  所有arena的内存池大小及其高水位
+        size_t heap_size;
+        size_t heap_peak;
+        //  chunk和region的个数
+        size_t chunk_count;
+        size_t region_count;
+        //  内存池中还没有切分的字节数，即各arena [_start_free, _end_free) 的大小之和
+        size_t pool_bytes;
+    };
+
+    //  读取统计信息
+    //  分配/释放次数分散在各个线程的缓存中，这里加锁遍历所有线程缓存并汇总，
+    //  快速路径上只有线程内的计数，可以在生产环境中一直开启
+    static pool_stats stats()
+    {
+        pool_stats __s;
+        std::memset(&__s, 0, sizeof(__s));
+        {
+            std::lock_guard<std::mutex> guard(_registry_mtx);
+            for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+            {
+                __s.classes[__i].allocations = _retired_allocs[__i];
+                __s.classes[__i].frees = _retired_frees[__i];
+            }
+            for (_ThreadCache* __tc = _registry; __tc != 0; __tc = __tc->_M_next)
+            {
+                for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+                {
+                    __s.classes[__i].allocations += __atomic_load_n(&__tc->_M_allocs[__i], __ATOMIC_RELAXED);
+                    __s.classes[__i].frees += __atomic_load_n(&__tc->_M_frees[__i], __ATOMIC_RELAXED);
+                }
+            }
+        }
+
+        long long __objects[__NFREELISTS] = { 0 };
+        for (int __node = 0; __node < __region_alloc::node_count(); __node++)
+        {
+            _Arena& __a = _arenas[__node];
+            std::lock_guard<std::mutex> guard(__a._M_mtx);
+            for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+            {
+                __s.classes[__i].refills += __a._M_refills[__i];
+                __s.classes[__i].carved_bytes += __a._M_carved_bytes[__i];
+                __objects[__i] += (long long)__a._M_objects[__i];
+            }
+            __s.heap_size += __a._M_heap_size;
+            __s.heap_peak += __a._M_heap_peak;
+            __s.chunk_count += __a._M_chunk_count;
+            __s.pool_bytes += __a._M_end_free - __a._M_start_free;
+        }
+        __s.region_count = __region_alloc::region_count();
+
+        for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+        {
+            class_stats& __c = __s.classes[__i];
+            __c.class_size = _class_size(__i);
+            //  各线程的计数是分别读取的，汇总结果可能短暂地不一致，不让它出现负数
+            long long __live = (long long)__c.allocations - (long long)__c.frees;
+            __c.free_objects = __objects[__i] > __live ? (size_t)(__objects[__i] - __live) : 0;
+        }
+        return __s;
+    }
+
+    //  把完全空闲的chunk的物理页还给操作系统，返回还给系统的字节数
+    //  只能看到arena自由链表、远程释放队列、各CPU缓存和调用线程缓存中的空闲对象，其他线程缓存中还有对象的chunk不会被释放
+    //  对象可能被别的结点上的线程释放并归还到那个结点的arena，所以所有arena一起统计
+    static size_t trim()
+    {
+        //  先把本线程缓存、span和所有远程释放队列中的对象全部归还，否则它们所在的chunk永远不会被认为是空闲的
+        //  线程缓存已经析构时它是空的，也不能再往里面放对象
+        _ThreadCache& __tc = _tcache;
+#ifdef __ALLOC_HAS_RSEQ
+        _cpu_drain_all(__tc);
+#endif
+        if (!__tc._M_dead)
+        {
+            for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+            {
+                _remote_flush(__tc, __i);
+            }
+            for (size_t __w = 0; __w < (size_t)__OWNER_WORDS; __w++)
+            {
+                uint64_t __bits = __atomic_exchange_n(&_remote_pending[__w], 0, __ATOMIC_ACQUIRE);
+                //  与_remote_flush中的栅栏配对，见那里的说明
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                while (__bits != 0)
+                {
+                    uint16_t __owner = (uint16_t)(__w * 64 + __builtin_ctzll(__bits));
+                    __bits &= __bits - 1;
+                    for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+                    {
+                        _remote_take(__tc, __owner, __i);
+                    }
+                }
+            }
+            for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+            {
+                _span_release(__tc, __i);
+                if (__tc._M_count[__i] != 0)
+                {
+                    _tcache_flush(__tc, __i, __tc._M_count[__i]);
+                }
+            }
+        }
+
+        //  按结点编号的顺序给所有arena加锁，不会和其他线程形成死锁
+        const int __nodes = __region_alloc::node_count();
+        size_t __total_chunks = 0;
+        for (int __node = 0; __node < __nodes; __node++)
+        {
+            _arenas[__node]._M_mtx.lock();
+            __total_chunks += _arenas[__node]._M_chunk_count;
+        }
+
+        //  按地址排序的chunk数组，用于查找对象所在的chunk
+        //  直接向系统映射，不经过malloc和本配置器
+        size_t __released = 0;
+        size_t __map_bytes = __total_chunks * sizeof(_Chunk*);
+        void* __map = __total_chunks == 0 ? MAP_FAILED
+            : mmap(0, __map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (__map != MAP_FAILED)
+        {
+            _Chunk** __chunks = (_Chunk**)__map;
+            size_t __n = 0;
+            for (int __node = 0; __node < __nodes; __node++)
+            {
+                for (_Chunk* __chunk = _arenas[__node]._M_chunk_list; __chunk != 0; __chunk = __chunk->_M_next)
+                {
+                    __chunk->_M_free = 0;
+                    if (!__chunk->_M_released)
+                    {
+                        __chunks[__n++] = __chunk;
+                    }
+                }
+            }
+            std::sort(__chunks, __chunks + __n);
+
+            //  取下所有自由链表，统计每个chunk中空闲对象占用的字节数
+            _Obj* __lists[__region_alloc::__MAX_NODES][__NFREELISTS];
+            _Chunk* __pool_chunk[__region_alloc::__MAX_NODES];
+            for (int __node = 0; __node < __nodes; __node++)
+            {
+                _Arena& __a = _arenas[__node];
+                for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+                {
+                    __lists[__node][__i] = __a._M_free_list[__i].pop_all();
+                    for (_Obj* __p = __lists[__node][__i]; __p != 0; __p = __p->_M_free_list_link)
+                    {
+                        _chunk_find(__chunks, __n, __p)->_M_free += _class_size(__i);
+                    }
+                }
+                //  内存池中还没有切分的部分也是空闲的
+                __pool_chunk[__node] = 0;
+                if (__a._M_start_free != __a._M_end_free)
+                {
+                    __pool_chunk[__node] = _chunk_find(__chunks, __n, __a._M_start_free);
+                    __pool_chunk[__node]->_M_free += __a._M_end_free - __a._M_start_free;
+                }
+            }
+
+            //  空闲字节数加上跳过的字节数等于chunk的大小，说明其中没有正在使用的对象
+            //  先把不在这些chunk中的空闲对象挂回原来的自由链表，再释放chunk：
+            //  madvise之后页中的内容读出来都是0，释放之后再沿着_M_free_list_link遍历会在第一个被释放的对象处断开
+            for (int __node = 0; __node < __nodes; __node++)
+            {
+                _Arena& __a = _arenas[__node];
+                for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+                {
+                    _Obj* __first = 0;
+                    _Obj* __last = 0;
+                    _Obj* __next;
+                    for (_Obj* __p = __lists[__node][__i]; __p != 0; __p = __next)
+                    {
+                        __next = __p->_M_free_list_link;
+                        if (_chunk_idle(_chunk_find(__chunks, __n, __p)))
+                        {
+                            __a._M_objects[__i]--;
+                            continue;
+                        }
+                        __p->_M_free_list_link = __first;
+                        __first = __p;
+                        if (__last == 0)
+                        {
+                            __last = __p;
+                        }
+                    }
+                    if (__first != 0)
+                    {
+                        __a._M_free_list[__i].push(__first, __last);
+                    }
+                }
+            }
+
+            for (int __node = 0; __node < __nodes; __node++)
+            {
+                _Arena& __a = _arenas[__node];
+                for (_Chunk* __chunk = __a._M_chunk_list; __chunk != 0; __chunk = __chunk->_M_next)
+                {
+                    if (_chunk_idle(__chunk))
+                    {
+                        __released += _chunk_release(__chunk);
+                        __a._M_heap_size -= __chunk->_M_size;
+                    }
+                }
+                if (__pool_chunk[__node] != 0 && __pool_chunk[__node]->_M_released)
+                {
+                    __a._M_start_free = __a._M_end_free = 0;
+                }
+            }
+            munmap(__map, __map_bytes);
+        }
+
+        for (int __node = __nodes - 1; __node >= 0; __node--)
+        {
+            _arenas[__node]._M_mtx.unlock();
+        }
+        return __released;
+    }
+
+    //  锁住配置器的全部状态，用于pthread_atfork：fork之前加锁，之后在父子进程中分别解锁，
+    //  子进程中只剩fork的线程，不加锁的话其他线程持有的锁在子进程里永远不会释放
+    //  加锁顺序与其他路径相同：回收函数表(持有它时会调用trim)、线程注册表、按结点编号的arena、
+    //  CPU缓存表、region，最后是分配记录器的文件，持有它时不会再获取其他锁
+    //  __monotonic_arena的空闲block栈在它之后定义，由调用者另外加锁
+    static void lock_all()
+    {
+        __malloc_alloc_template::lock();
+        _registry_mtx.lock();
+        for (int __node = 0; __node < (int)__region_alloc::__MAX_NODES; __node++)
+        {
+            _arenas[__node]._M_mtx.lock();
+        }
+#ifdef __ALLOC_HAS_RSEQ
+        _cpu_mtx.lock();
+#endif
+        __region_alloc::lock();
+        __alloc_trace::lock();
+    }
+
+    static void unlock_all()
+    {
+        __alloc_trace::unlock();
+        __region_alloc::unlock();
+#ifdef __ALLOC_HAS_RSEQ
+        _cpu_mtx.unlock();
+#endif
+        for (int __node = (int)__region_alloc::__MAX_NODES - 1; __node >= 0; __node--)
+        {
+            _arenas[__node]._M_mtx.unlock();
+        }
+        _registry_mtx.unlock();
+        __malloc_alloc_template::unlock();
+    }
+};
+
+//  静态存储期的对象会被零初始化，所有自由链表一开始都是空栈
+template <class _Classes>
+typename __basic_default_alloc<_Classes>::_Arena __basic_default_alloc<_Classes>::_arenas[__region_alloc::__MAX_NODES];
+
+#ifdef __ALLOC_HAS_RSEQ
+template <class _Classes>
+typename __basic_default_alloc<_Classes>::_CpuCache* __basic_default_alloc<_Classes>::_cpu_caches[__MAX_CPUS];
+
+template <class _Classes>
+std::mutex __basic_default_alloc<_Classes>::_cpu_mtx;
+#endif
+
+//  内存不足或者RSS超过上限时，先把内存池中完全空闲的chunk还给系统
+template <class _Classes>
+typename __basic_default_alloc<_Classes>::_TrimReclaimer __basic_default_alloc<_Classes>::_trim_reclaimer;
+
+template <class _Classes>
+thread_local typename __basic_default_alloc<_Classes>::_ThreadCache __basic_default_alloc<_Classes>::_tcache;
+
+template <class _Classes>
+typename __basic_default_alloc<_Classes>::_ThreadCache* __basic_default_alloc<_Classes>::_registry = nullptr;
+
+template <class _Classes>
+size_t __basic_default_alloc<_Classes>::_retired_allocs[__NFREELISTS];
+
+template <class _Classes>
+size_t __basic_default_alloc<_Classes>::_retired_frees[__NFREELISTS];
+
+template <class _Classes>
+std::mutex __basic_default_alloc<_Classes>::_registry_mtx;
+
+template <class _Classes>
+typename __basic_default_alloc<_Classes>::_Obj* __basic_default_alloc<_Classes>::_remote[__MAX_OWNERS][__NFREELISTS];
+
+template <class _Classes>
+uint64_t __basic_default_alloc<_Classes>::_remote_pending[__OWNER_WORDS];
+
+template <class _Classes>
+size_t __basic_default_alloc<_Classes>::_next_owner = 1;
+
+template <class _Classes>
+uint16_t __basic_default_alloc<_Classes>::_free_owners[__MAX_OWNERS];
+
+template <class _Classes>
+size_t __basic_default_alloc<_Classes>::_free_owner_count = 0;
+
+//  默认大小类的二级配置器
+typedef __basic_default_alloc<__default_size_classes> __default_alloc_base;
+
+//  单线程配置器：大小类和接口与二级配置器相同，vector和list可以通过Alloc参数选用
+//  所有状态都是线程私有的普通变量，没有锁、原子操作、page map和远程释放，
+//  只能用于分配和释放都在同一个线程中的组件；每个线程各自一份，
+//  线程退出时它的空闲对象交给之后内存池不够用的线程，它分配出去、还没有释放的对象不会被回收
+//  自由链表为空时直接从内存池切下一个对象，不预先切分一批
+template <class _Classes>
+class __basic_single_thread_alloc
+{
+private:
+    typedef __basic_default_alloc<_Classes> _Pool;
+
+    enum { __MAX_BYTES = _Pool::__MAX_BYTES };
+    enum { __NFREELISTS = _Pool::__NFREELISTS };
+    //  每次向region申请的最小字节数，之后随已经申请的总量增长
+    enum { __CHUNK_BYTES = 64 * 1024 };
+
+    union _Obj
+    {
+        union _Obj* _M_free_list_link;
+        char _M_client_data[1];
+    };
+
+    //  只有平凡的成员，thread_local不需要初始化检查
+    struct _State
+    {
+        _Obj* _M_free_list[__NFREELISTS];
+        char* _M_start_free;
+        char* _M_end_free;
+        size_t _M_heap_size;
+    };
+    static thread_local _State _state;
+
+    //  已经退出的线程留下的空闲对象，由_orphan_mtx保护；_has_orphans不加锁读，为false时不用加锁
+    static _Obj* _orphans[__NFREELISTS];
+    static bool _has_orphans;
+    static std::mutex _orphan_mtx;
+
+    //  线程第一次向region申请内存时创建，线程退出时析构，把本线程的空闲对象交出去
+    struct _Retire
+    {
+        ~_Retire()
+        {
+            _retire();
+        }
+    };
+
+    //  内存池剩下的部分切成对象，连同所有自由链表一起挂到_orphans上
+    static void _retire()
+    {
+        _State& __s = _state;
+        _stash();
+        std::lock_guard<std::mutex> guard(_orphan_mtx);
+        for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+        {
+            _Obj* __first = __s._M_free_list[__i];
+            if (__first == 0)
+            {
+                continue;
+            }
+            _Obj* __last = __first;
+            while (__last->_M_free_list_link != 0)
+            {
+                __last = __last->_M_free_list_link;
+            }
+            __last->_M_free_list_link = _orphans[__i];
+            _orphans[__i] = __first;
+            __s._M_free_list[__i] = 0;
+        }
+        __atomic_store_n(&_has_orphans, true, __ATOMIC_RELEASE);
+    }
+
+    //  取走已经退出的线程留下的全部空闲对象，挂到本线程的自由链表上，没有时返回false
+    static bool _adopt()
+    {
+        if (!__atomic_load_n(&_has_orphans, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        _State& __s = _state;
+        std::lock_guard<std::mutex> guard(_orphan_mtx);
+        for (size_t __i = 0; __i < (size_t)__NFREELISTS; __i++)
+        {
+            _Obj* __first = _orphans[__i];
+            if (__first == 0)
+            {
+                continue;
+            }
+            _Obj* __last = __first;
+            while (__last->_M_free_list_link != 0)
+            {
+                __last = __last->_M_free_list_link;
+            }
+            __last->_M_free_list_link = __s._M_free_list[__i];
+            __s._M_free_list[__i] = __first;
+            _orphans[__i] = 0;
+        }
+        __atomic_store_n(&_has_orphans, false, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    //  从内存池切下一个第__index个大小类的对象，起点对齐到大小类的自然对齐
+    //  新切出的内存没有写过；取到退出线程留下的对象时把前__zero字节清零
+    static void* _carve(size_t __index, size_t __zero)
+    {
+        _State& __s = _state;
+        size_t __size = _Pool::_class_size(__index);
+        uintptr_t __align = _Pool::_class_align(__index);
+        char* __p = (char*)(((uintptr_t)__s._M_start_free + __align - 1) & ~(__align - 1));
+        if (__p + __size > __s._M_end_free)
+        {
+            //  内存池放不下时先取退出线程留下的对象，其中有这个大小类的就不用向region申请
+            _Obj*& __list = __s._M_free_list[__index];
+            if (_adopt() && __list != 0)
+            {
+                _Obj* __result = __list;
+                __list = __result->_M_free_list_link;
+                std::memset(__result, 0, __zero);
+                return __result;
+            }
+            _grow(__size);
+            return _carve(__index, __zero);
+        }
+        __s._M_start_free = __p + __size;
+        return __p;
+    }
+
+    //  内存池放不下__size字节：剩下的部分切成对象挂到自由链表上，再向region申请一块
+    static void _grow(size_t __size)
+    {
+        static thread_local _Retire __retire;
+        (void)__retire;
+        _State& __s = _state;
+        _stash();
+        size_t __want = (size_t)__CHUNK_BYTES + __s._M_heap_size / 8;
+        if (__want > (size_t)__region_alloc::__REGION_SIZE)
+        {
+            __want = __region_alloc::__REGION_SIZE;
+        }
+        //  加上对齐可能跳过的字节
+        size_t __min = __size + _Pool::__MAX_ALIGN;
+        size_t __got = 0;
+        void* __mem = __region_alloc::allocate(__region_alloc::current_node(), __min, __want, __got);
+        while (__mem == nullptr)
+        {
+            __malloc_alloc_template::handle_oom(__min);
+            __mem = __region_alloc::allocate(__region_alloc::current_node(), __min, __want, __got);
+        }
+        __s._M_start_free = (char*)__mem;
+        __s._M_end_free = (char*)__mem + __got;
+        __s._M_heap_size += __got;
+    }
+
+    //  把内存池剩下的空间按能放下、并且地址满足对齐的最大大小类切开，挂到自由链表上
+    static void _stash()
+    {
+        _State& __s = _state;
+        while ((size_t)(__s._M_end_free - __s._M_start_free) >= (size_t)_Pool::__ALIGN)
+        {
+            size_t __bytes = __s._M_end_free - __s._M_start_free;
+            size_t __index = _Pool::_freelist_index(__bytes);
+            while (_Pool::_class_size(__index) > __bytes
+                   || ((uintptr_t)__s._M_start_free & (_Pool::_class_align(__index) - 1)) != 0)
+            {
+                __index--;
+            }
+            _Obj* __p = (_Obj*)__s._M_start_free;
+            __p->_M_free_list_link = __s._M_free_list[__index];
+            __s._M_free_list[__index] = __p;
+            __s._M_start_free += _Pool::_class_size(__index);
+        }
+    }
+
+public:
+    enum { max_bytes = __MAX_BYTES };
+    typedef _Classes size_classes;
+
+    static void* allocate(size_t __n)
+    {
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            return __malloc_alloc_template::allocate(__n);
+        }
+        return allocate_class(_Pool::_freelist_index(__n), __n);
+    }
+
+    static void deallocate(void* __p, size_t __n)
+    {
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            __malloc_alloc_template::deallocate(__p);
+            return;
+        }
+        deallocate_class(__p, _Pool::_freelist_index(__n), __n);
+    }
+
+    //  大小类下标已知时的allocate/deallocate，与二级配置器相同
+    static void* allocate_class(size_t __index, size_t)
+    {
+        _Obj*& __list = _state._M_free_list[__index];
+        _Obj* __result = __list;
+        if (__result != 0)
+        {
+            __list = __result->_M_free_list_link;
+            return __result;
+        }
+        return _carve(__index, 0);
+    }
+
+    static void deallocate_class(void* __p, size_t __index, size_t)
+    {
+        _Obj*& __list = _state._M_free_list[__index];
+        ((_Obj*)__p)->_M_free_list_link = __list;
+        __list = (_Obj*)__p;
+    }
+
+    //  内容全为0的内存：自由链表上的对象需要清零，从region新切出来的本来就是0
+    static void* allocate_zeroed(size_t __n)
+    {
+        if ((size_t)__MAX_BYTES < __n)
+        {
+            return __malloc_alloc_template::allocate_zeroed(__n);
+        }
+        size_t __index = _Pool::_freelist_index(__n);
+        _Obj*& __list = _state._M_free_list[__index];
+        _Obj* __result = __list;
+        if (__result != 0)
+        {
+            __list = __result->_M_free_list_link;
+            std::memset(__result, 0, __n);
+            return __result;
+        }
+        return _carve(__index, __n);
+    }
+
+    static void* reallocate(void* __p, size_t __old_sz, size_t __new_sz)
+    {
+        if (__old_sz > (size_t)__MAX_BYTES && __new_sz > (size_t)__MAX_BYTES)
+        {
+            return __malloc_alloc_template::reallocate(__p, __new_sz);
+        }
+        if (__old_sz <= (size_t)__MAX_BYTES && __new_sz <= (size_t)__MAX_BYTES
+            && _Pool::_freelist_index(__old_sz) == _Pool::_freelist_index(__new_sz))
+        {
+            return __p;
+        }
+        void* __result = allocate(__new_sz);
+        std::memcpy(__result, __p, __new_sz > __old_sz ? __old_sz : __new_sz);
+        deallocate(__p, __old_sz);
+        return __result;
+    }
+
+    //  与二级配置器相同：对齐不超过64字节时选用自然对齐满足要求的大小类
+    static void* allocate_aligned(size_t __n, size_t __align)
+    {
+        if (__align <= (size_t)_Pool::__ALIGN)
+        {
+            return allocate(__n);
+        }
+        if (__align > (size_t)_Pool::__MAX_ALIGN || __n > (size_t)__MAX_BYTES)
+        {
+            return __malloc_alloc_template::allocate_aligned(__n, __align);
+        }
+        return allocate(_Pool::_class_size(_Pool::_aligned_index(__n, __align)));
+    }
+
+    static void deallocate_aligned(void* __p, size_t __n, size_t __align)
+    {
+        if (__align <= (size_t)_Pool::__ALIGN)
+        {
+            deallocate(__p, __n);
+        }
+        else if (__align > (size_t)_Pool::__MAX_ALIGN || __n > (size_t)__MAX_BYTES)
+        {
+            __malloc_alloc_template::deallocate(__p);
+        }
+        else
+        {
+            deallocate(__p, _Pool::_class_size(_Pool::_aligned_index(__n, __align)));
+        }
+    }
+
+    //  批量接口：没有锁可以省，逐个分配
+    static void allocate_batch(size_t __n, size_t __count, void** __out)
+    {
+        size_t __i = 0;
+        try
+        {
+            for (; __i < __count; __i++)
+            {
+                __out[__i] = allocate(__n);
+            }
+        }
+        catch (...)
+        {
+            while (__i > 0)
+            {
+                deallocate(__out[--__i], __n);
+            }
+            throw;
+        }
+    }
+
+    static void deallocate_batch(size_t __n, size_t __count, void** __p)
+    {
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            deallocate(__p[__i], __n);
+        }
+    }
+
+    //  本线程向region申请的总字节数
+    static size_t heap_size()
+    {
+        return _state._M_heap_size;
+    }
+};
+
+template <class _Classes>
+thread_local typename __basic_single_thread_alloc<_Classes>::_State __basic_single_thread_alloc<_Classes>::_state;
+
+template <class _Classes>
+typename __basic_single_thread_alloc<_Classes>::_Obj* __basic_single_thread_alloc<_Classes>::_orphans[__NFREELISTS];
+
+template <class _Classes>
+bool __basic_single_thread_alloc<_Classes>::_has_orphans = false;
+
+template <class _Classes>
+std::mutex __basic_single_thread_alloc<_Classes>::_orphan_mtx;
+
+typedef __basic_single_thread_alloc<__default_size_classes> __single_thread_alloc;
+
+//  单调(monotonic)arena：只会向后移动指针分配，不单独回收对象，
+//  所有内存通过rollback/reset/release一次性归还，适合一批同生共死的临时对象
+//  内存按64KB的block向region申请，和二级配置器的chunk来自同一处；
+//  归还的block进入全局的空闲block栈，供之后的arena复用。一个arena只能由一个线程使用
+class __monotonic_arena
+{
+private:
+    //  标准block的大小，放不下的大对象单独用一级配置器申请一个block
+    enum { __BLOCK_SIZE = 64 * 1024 };
+
+    //  block的头部，所有block串成一条链表，最新的在前
+    struct _Block
+    {
+        _Block* _M_next;
+        //  包括头部在内的字节数，不等于__BLOCK_SIZE的是单独申请的大block
+        size_t _M_size;
+
+        char* _begin() { return (char*)(this + 1); }
+        char* _end() { return (char*)this + _M_size; }
+    };
+
+    _Block* _M_blocks;
+    //  当前block中还没有分配的部分
+    char* _M_cur;
+    char* _M_end;
+    //  持有的block的总字节数
+    size_t _M_reserved;
+
+    //  所有arena归还的标准block
+    static _Block* _free_blocks;
+    static std::mutex _block_mtx;
+
+    //  取一个标准block：先复用空闲block，再从本结点的region中切，region映射失败时用一级配置器
+    static _Block* _get_block()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_block_mtx);
+            if (_free_blocks != 0)
+            {
+                _Block* __b = _free_blocks;
+                _free_blocks = __b->_M_next;
+                return __b;
+            }
+        }
+        size_t __got = 0;
+        void* __mem = __region_alloc::allocate(__region_alloc::current_node(), __BLOCK_SIZE, __BLOCK_SIZE, __got);
+        if (__mem == 0)
+        {
+            __mem = __malloc_alloc_template::allocate(__BLOCK_SIZE);
+        }
+        _Block* __b = (_Block*)__mem;
+        __b->_M_size = __BLOCK_SIZE;
+        return __b;
+    }
+
+    //  把[__first, __last)之间的block还回去：标准block整段压入空闲栈，大block直接释放
+    static void _put_blocks(_Block* __first, _Block* __last)
+    {
+        _Block* __head = 0;
+        _Block* __tail = 0;
+        while (__first != __last)
+        {
+            _Block* __b = __first;
+            __first = __first->_M_next;
+            if (__b->_M_size != (size_t)__BLOCK_SIZE)
+            {
+                __malloc_alloc_template::deallocate(__b);
+                continue;
+            }
+            __b->_M_next = __head;
+            __head = __b;
+            if (__tail == 0)
+            {
+                __tail = __b;
+            }
+        }
+        if (__head != 0)
+        {
+            std::lock_guard<std::mutex> guard(_block_mtx);
+            __tail->_M_next = _free_blocks;
+            _free_blocks = __head;
+        }
+    }
+
+    //  当前block放不下时调用
+    void* _grow(size_t __n, size_t __align)
+    {
+        //  大对象单独申请一个block，插在链表头部，当前block还可以继续使用
+        if (__n + __align > (size_t)__BLOCK_SIZE - sizeof(_Block))
+        {
+            size_t __size = sizeof(_Block) + __n + __align;
+            _Block* __b = (_Block*)__malloc_alloc_template::allocate(__size);
+            __b->_M_size = __size;
+            __b->_M_next = _M_blocks;
+            _M_blocks = __b;
+            _M_reserved += __size;
+            return (void*)(((uintptr_t)__b->_begin() + __align - 1) & ~((uintptr_t)__align - 1));
+        }
+        _Block* __b = _get_block();
+        __b->_M_next = _M_blocks;
+        _M_blocks = __b;
+        _M_reserved += __b->_M_size;
+        _M_cur = __b->_begin();
+        _M_end = __b->_end();
+        return allocate(__n, __align);
+    }
+
+public:
+    //  rollback的位置
+    struct mark
+    {
+        _Block* _M_block;
+        char* _M_cur;
+        char* _M_end;
+    };
+
+    __monotonic_arena() : _M_blocks(0), _M_cur(0), _M_end(0), _M_reserved(0) {}
+
+    __monotonic_arena(const __monotonic_arena&) = delete;
+    __monotonic_arena& operator=(const __monotonic_arena&) = delete;
+
+    ~__monotonic_arena()
+    {
+        release();
+    }
+
+    //  分配__n字节，按__align对齐，__align是2的幂
+    void* allocate(size_t __n, size_t __align = 8)
+    {
+        char* __p = (char*)(((uintptr_t)_M_cur + __align - 1) & ~((uintptr_t)__align - 1));
+        if (_M_cur != 0 && __p <= _M_end && __n <= (size_t)(_M_end - __p))
+        {
+            _M_cur = __p + __n;
+            return __p;
+        }
+        return _grow(__n, __align);
+    }
+
+    //  不单独回收对象；只有释放的恰好是最后一次分配的对象时，把指针退回去
+    void deallocate(void* __p, size_t __n)
+    {
+        if ((char*)__p + __n == _M_cur)
+        {
+            _M_cur = (char*)__p;
+        }
+    }
+
+    //  记录当前位置
+    mark get_mark() const
+    {
+        mark __m;
+        __m._M_block = _M_blocks;
+        __m._M_cur = _M_cur;
+        __m._M_end = _M_end;
+        return __m;
+    }
+
+    //  回到__m记录的位置，之后分配的内存全部作废，之后申请的block归还
+    void rollback(const mark& __m)
+    {
+        for (_Block* __b = _M_blocks; __b != __m._M_block; __b = __b->_M_next)
+        {
+            _M_reserved -= __b->_M_size;
+        }
+        _put_blocks(_M_blocks, __m._M_block);
+        _M_blocks = __m._M_block;
+        _M_cur = __m._M_cur;
+        _M_end = __m._M_end;
+    }
+
+    //  作废所有分配，只保留最新的一个标准block以便马上重新使用，其余block归还
+    void reset()
+    {
+        _Block* __keep = _M_blocks;
+        while (__keep != 0 && __keep->_M_size != (size_t)__BLOCK_SIZE)
+        {
+            __keep = __keep->_M_next;
+        }
+        if (__keep == 0)
+        {
+            release();
+            return;
+        }
+        _put_blocks(_M_blocks, __keep);
+        _put_blocks(__keep->_M_next, 0);
+        __keep->_M_next = 0;
+        _M_blocks = __keep;
+        _M_reserved = __keep->_M_size;
+        _M_cur = __keep->_begin();
+        _M_end = __keep->_end();
+    }
+
+    //  作废所有分配，归还所有block
+    void release()
+    {
+        _put_blocks(_M_blocks, 0);
+        _M_blocks = 0;
+        _M_cur = _M_end = 0;
+        _M_reserved = 0;
+    }
+
+    //  持有的block的总字节数
+    size_t reserved() const
+    {
+        return _M_reserved;
+    }
+
+    //  fork前后在__default_alloc_base::lock_all之后加锁、unlock_all之前解锁
+    static void lock()
+    {
+        _block_mtx.lock();
+    }
+
+    static void unlock()
+    {
+        _block_mtx.unlock();
+    }
+};
+
+__monotonic_arena::_Block* __monotonic_arena::_free_blocks = nullptr;
+
+std::mutex __monotonic_arena::_block_mtx;
+
+//  把__monotonic_arena包装成vector和list的Alloc参数：静态接口转发给本线程当前绑定的arena
+//  用scope在一段作用域内绑定，可以嵌套；没有绑定时使用本线程默认的arena，线程退出时归还
+//  deallocate基本不回收内存，容器析构也不需要逐个释放，arena整体rollback/reset即可
+class __arena_alloc
+{
+private:
+    static thread_local __monotonic_arena* _current;
+    static thread_local __monotonic_arena _default;
+
+public:
+    //  在作用域内把本线程的__arena_alloc绑定到__a
+    class scope
+    {
+    private:
+        __monotonic_arena* _M_prev;
+
+    public:
+        explicit scope(__monotonic_arena& __a) : _M_prev(_current)
+        {
+            _current = &__a;
+        }
+
+        ~scope()
+        {
+            _current = _M_prev;
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+    };
+
+    //  本线程当前使用的arena
+    static __monotonic_arena& arena()
+    {
+        return _current != 0 ? *_current : _default;
+    }
+
+    static void* allocate(size_t __n)
+    {
+        return arena().allocate(__n);
+    }
+
+    static void deallocate(void* __p, size_t __n)
+    {
+        arena().deallocate(__p, __n);
+    }
+
+    //  缩小时原地不动；扩大时重新分配并拷贝
+    static void* reallocate(void* __p, size_t __old_sz, size_t __new_sz)
+    {
+        if (__new_sz <= __old_sz)
+        {
+            return __p;
+        }
+        void* __result = allocate(__new_sz);
+        std::memcpy(__result, __p, __old_sz);
+        deallocate(__p, __old_sz);
+        return __result;
+    }
+
+    static void* allocate_aligned(size_t __n, size_t __align)
+    {
+        return arena().allocate(__n, __align);
+    }
+
+    static void deallocate_aligned(void* __p, size_t __n, size_t)
     {
-        void* __result;
-        size_t __copy_sz;
+        arena().deallocate(__p, __n);
+    }
 
-        //  如果旧内存和新内存的大小都大于_MAX_BYTES（128），则直接调用reallocate函数进行内存重分配
-        if (__old_sz > (size_t)__MAX_BYTES && __new_sz > (size_t)__MAX_BYTES)
+    //  整批一次切出，对象之间按8字节对齐
+    static void allocate_batch(size_t __n, size_t __count, void** __out)
+    {
+        size_t __size = (__n + 7) & ~(size_t)7;
+        char* __p = (char*)arena().allocate(__size * __count);
+        for (size_t __i = 0; __i < __count; __i++)
         {
-            return (__malloc_alloc_template<0>::reallocate(__p, __new_sz));
+            __out[__i] = __p + __i * __size;
         }
+    }
+
+    static void deallocate_batch(size_t, size_t, void**)
+    {
+    }
+};
+
+thread_local __monotonic_arena* __arena_alloc::_current = nullptr;
+
+thread_local __monotonic_arena __arena_alloc::_default;
+
+#ifdef __ALLOC_HAS_PMR
+//  把静态接口的配置器(__default_alloc_template等)包装成std::pmr::memory_resource，
+//  std::pmr::vector、std::pmr::string等标准容器就可以和本库的容器共用同一个内存池
+//  配置器的状态都是静态的，同一个Alloc的所有实例都相等，用instance()取全局的一个即可
+template <class Alloc>
+class __pool_resource : public std::pmr::memory_resource
+{
+public:
+    static __pool_resource* instance()
+    {
+        static __pool_resource __r;
+        return &__r;
+    }
 
-        //  如果新旧内存的大小相同，则不需要进行内存操作，直接返回旧内存指针
-        if (_round_up(__old_sz) == _round_up(__new_sz))
+protected:
+    void* do_allocate(size_t __bytes, size_t __align) override
+    {
+        //  0字节的请求也要返回一个可以释放的指针
+        if (__bytes == 0)
         {
-            return (__p);
+            __bytes = 1;
+        }
+        if (__align <= 8)
+        {
+            return Alloc::allocate(__bytes);
         }
+        return Alloc::allocate_aligned(__bytes, __align);
+    }
 
-        //  如果需要进行内存操作，则先调用allocate函数分配新内存，然后将旧内存中的数据拷贝到新内存中
-        //  分配新内存
-        __result = allocate(__new_sz);
-        //  计算拷贝大小，取较小值
-        __copy_sz = __new_sz > __old_sz ? __old_sz : __new_sz;
-        //  将旧内存中的数据拷贝到新内存中
-        std::memcpy(__result, __p, __copy_sz);
+    void do_deallocate(void* __p, size_t __bytes, size_t __align) override
+    {
+        if (__bytes == 0)
+        {
+            __bytes = 1;
+        }
+        if (__align <= 8)
+        {
+            Alloc::deallocate(__p, __bytes);
+            return;
+        }
+        Alloc::deallocate_aligned(__p, __bytes, __align);
+    }
 
-        //  释放旧内存
-        deallocate(__p, __old_sz);
-        //  返回新内存首地址
-        return(__result);
+    bool do_is_equal(const std::pmr::memory_resource& __other) const noexcept override
+    {
+        return dynamic_cast<const __pool_resource*>(&__other) != nullptr;
+    }
+};
+
+//  把一个__monotonic_arena包装成std::pmr::memory_resource，释放只回退最后一次分配
+//  和std::pmr::monotonic_buffer_resource类似，但block来自本库的region并且可以rollback
+class __arena_resource : public std::pmr::memory_resource
+{
+private:
+    __monotonic_arena& _M_arena;
+
+public:
+    explicit __arena_resource(__monotonic_arena& __a) : _M_arena(__a) {}
 
+    __monotonic_arena& arena() const
+    {
+        return _M_arena;
+    }
+
+protected:
+    void* do_allocate(size_t __bytes, size_t __align) override
+    {
+        return _M_arena.allocate(__bytes, __align);
+    }
+
+    void do_deallocate(void* __p, size_t __bytes, size_t) override
+    {
+        _M_arena.deallocate(__p, __bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& __other) const noexcept override
+    {
+        const __arena_resource* __r = dynamic_cast<const __arena_resource*>(&__other);
+        return __r != nullptr && &__r->_M_arena == &_M_arena;
     }
+};
+#endif
 
+template<class T>
+struct __void_type
+{
+    typedef void type;
 };
 
-template<typename T>
-char* __default_alloc_template<T>::_start_free = nullptr;
+//  Alloc提供allocate_zeroed时为true
+template<class Alloc, class = void>
+struct __has_allocate_zeroed : std::false_type {};
+
+template<class Alloc>
+struct __has_allocate_zeroed<Alloc, typename __void_type<decltype(&Alloc::allocate_zeroed)>::type>
+    : std::true_type {};
+
+//  Alloc有大小类表(size_classes)和按下标分配的allocate_class/deallocate_class，
+//  并且__bytes字节的对象由它的自由链表管理时为true
+template<class Alloc, size_t __bytes, class = void>
+struct __has_size_class : std::false_type {};
+
+template<class Alloc, size_t __bytes>
+struct __has_size_class<Alloc, __bytes, typename __void_type<typename Alloc::size_classes>::type>
+    : std::integral_constant<bool, (__bytes <= (size_t)Alloc::size_classes::max_bytes)> {};
+
+// 定义符合STL规格的配置器接口, 不管是一级配置器还是二级配置器都是使用这个接口进行分配的
+template<class T, class Alloc>
+class simple_alloc
+{
+private:
+    //  alignof(T)超过8字节时，Alloc::allocate不能保证对齐，改用allocate_aligned
+    typedef std::integral_constant<bool, (alignof(T) > 8)> _over_aligned;
+    //  单个对象的大小类下标可以在编译期求出
+    typedef std::integral_constant<bool, (__has_size_class<Alloc, sizeof (T)>::value
+                                          && !_over_aligned::value)> _fixed_class;
+
+    //  sizeof(T)是常量，下标在编译期算好，分配时直接取对应的自由链表
+    static T *_allocate_one(std::true_type)
+    {
+        constexpr size_t __index = Alloc::size_classes::index(sizeof (T));
+        return (T*) Alloc::allocate_class(__index, sizeof (T));
+    }
+
+    static T *_allocate_one(std::false_type)
+    {
+        return (T*) _allocate(sizeof (T), _over_aligned());
+    }
+
+    static void _deallocate_one(T *p, std::true_type)
+    {
+        constexpr size_t __index = Alloc::size_classes::index(sizeof (T));
+        Alloc::deallocate_class(p, __index, sizeof (T));
+    }
+
+    static void _deallocate_one(T *p, std::false_type)
+    {
+        _deallocate(p, sizeof (T), _over_aligned());
+    }
+
+    static void *_allocate(size_t bytes, std::false_type)
+    {
+        return Alloc::allocate(bytes);
+    }
+
+    static void *_allocate(size_t bytes, std::true_type)
+    {
+        return Alloc::allocate_aligned(bytes, alignof(T));
+    }
+
+    //  Alloc有allocate_zeroed并且不需要额外对齐时由它清零，否则分配之后再清零
+    typedef std::integral_constant<bool, (__has_allocate_zeroed<Alloc>::value
+                                          && !_over_aligned::value)> _zeroed;
+
+    static void *_allocate_zeroed(size_t bytes, std::true_type)
+    {
+        return Alloc::allocate_zeroed(bytes);
+    }
+
+    static void *_allocate_zeroed(size_t bytes, std::false_type)
+    {
+        void *p = _allocate(bytes, _over_aligned());
+        std::memset(p, 0, bytes);
+        return p;
+    }
+
+    static void _deallocate(T *p, size_t bytes, std::false_type)
+    {
+        Alloc::deallocate(p, bytes);
+    }
+
+    static void _deallocate(T *p, size_t bytes, std::true_type)
+    {
+        Alloc::deallocate_aligned(p, bytes, alignof(T));
+    }
+
+    static void _allocate_batch(T **out, size_t count, std::false_type)
+    {
+        Alloc::allocate_batch(sizeof (T), count, (void**)out);
+    }
+
+    //  对齐分配没有批量接口，逐个申请
+    static void _allocate_batch(T **out, size_t count, std::true_type)
+    {
+        size_t i = 0;
+        try
+        {
+            for (; i < count; i++)
+            {
+                out[i] = (T*) _allocate(sizeof (T), std::true_type());
+            }
+        }
+        catch (...)
+        {
+            while (i > 0)
+            {
+                _deallocate(out[--i], sizeof (T), std::true_type());
+            }
+            throw;
+        }
+    }
+
+    static void _deallocate_batch(T **p, size_t count, std::false_type)
+    {
+        Alloc::deallocate_batch(sizeof (T), count, (void**)p);
+    }
+
+    static void _deallocate_batch(T **p, size_t count, std::true_type)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            _deallocate(p[i], sizeof (T), std::true_type());
+        }
+    }
+
+public:
+    static T *allocate(size_t n)
+    {
+        return 0 == n ? 0 : (T*) _allocate(n * sizeof (T), _over_aligned());
+    }
+
+    static T *allocate(void)
+    { 
+     return _allocate_one(_fixed_class()); 
+    }
+
+    //  申请n个对象的空间，内容全为0，用deallocate(p, n)释放
+    static T *allocate_zeroed(size_t n)
+    {
+        return 0 == n ? 0 : (T*) _allocate_zeroed(n * sizeof (T), _zeroed());
+    }
+
+    static void deallocate(T *p, size_t n)
+    { 
+        if (0 != n) _deallocate(p, n * sizeof (T), _over_aligned()); 
+    }
+
+    static void deallocate(T *p)
+    { 
+        _deallocate_one(p, _fixed_class()); 
+    }
+
+    //  一次申请count个对象，写入out
+    static void allocate_batch(T **out, size_t count)
+    {
+        _allocate_batch(out, count, _over_aligned());
+    }
+
+    //  一次释放count个对象
+    static void deallocate_batch(T **p, size_t count)
+    {
+        _deallocate_batch(p, count, _over_aligned());
+    }
+    
+};
+
+//  让一个类的对象用new/delete创建时从内存池分配：class node : public pooled<node> { ... };
+//  派生类继承这些operator new/delete，按new传入的实际大小选择大小类，
+//  通过基类指针delete派生类对象时基类需要有虚析构函数，否则传入的大小不对
+//  类中定义了operator new之后全局的placement new和nothrow new会被隐藏，这里一并提供
+template<class T, class Alloc = __default_alloc_base>
+class pooled
+{
+private:
+    //  不带对齐参数的new要返回满足__STDCPP_DEFAULT_NEW_ALIGNMENT__的内存(C++17之前为max_align_t的对齐)：
+    //  继承这些operator new的派生类可能比T对齐要求更高，只按alignof(T)分配是不够的
+#ifdef __STDCPP_DEFAULT_NEW_ALIGNMENT__
+    enum { __NEW_ALIGN = __STDCPP_DEFAULT_NEW_ALIGNMENT__ };
+#else
+    enum { __NEW_ALIGN = alignof(std::max_align_t) };
+#endif
+
+    //  T自身超过默认对齐时按alignof(T)，C++17之前没有带对齐参数的new，只能在这里处理
+    //  pooled<T>实例化时T还不完整，alignof(T)要到成员函数中才能求值
+    template<class U>
+    struct _new_align : std::integral_constant<size_t, (alignof(U) > (size_t)__NEW_ALIGN
+                                                        ? alignof(U) : (size_t)__NEW_ALIGN)> {};
+
+    static void *_allocate(size_t n)
+    {
+        return Alloc::allocate_aligned(n == 0 ? 1 : n, _new_align<T>::value);
+    }
+
+    static void _deallocate(void *p, size_t n)
+    {
+        Alloc::deallocate_aligned(p, n == 0 ? 1 : n, _new_align<T>::value);
+    }
+
+public:
+    static void *operator new(size_t n)
+    {
+        return _allocate(n);
+    }
+
+    static void *operator new[](size_t n)
+    {
+        return _allocate(n);
+    }
+
+    //  只提供带大小的delete，编译器会传入new时的大小(数组包括长度头部)
+    static void operator delete(void *p, size_t n)
+    {
+        if (p != 0)
+        {
+            _deallocate(p, n);
+        }
+    }
+
+    static void operator delete[](void *p, size_t n)
+    {
+        if (p != 0)
+        {
+            _deallocate(p, n);
+        }
+    }
+
+    static void *operator new(size_t n, const std::nothrow_t&) noexcept
+    {
+        try
+        {
+            return operator new(n);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return 0;
+        }
+    }
+
+    static void *operator new[](size_t n, const std::nothrow_t&) noexcept
+    {
+        try
+        {
+            return operator new[](n);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return 0;
+        }
+    }
+
+    //  nothrow new之后构造函数抛出异常时调用，此时没有大小可用，
+    //  由Alloc::free按地址找到大小类，只有提供free的配置器才能使用nothrow new
+    static void operator delete(void *p, const std::nothrow_t&) noexcept
+    {
+        Alloc::free(p);
+    }
+
+    static void operator delete[](void *p, const std::nothrow_t&) noexcept
+    {
+        Alloc::free(p);
+    }
+
+    static void *operator new(size_t, void *p) noexcept
+    {
+        return p;
+    }
+
+    static void *operator new[](size_t, void *p) noexcept
+    {
+        return p;
+    }
+
+    static void operator delete(void *, void *) noexcept {}
+
+    static void operator delete[](void *, void *) noexcept {}
+
+#ifdef __cpp_aligned_new
+    //  对象(包括派生类对象)的对齐超过__STDCPP_DEFAULT_NEW_ALIGNMENT__时编译器调用带对齐参数的版本
+    static void *operator new(size_t n, std::align_val_t align)
+    {
+        return Alloc::allocate_aligned(n == 0 ? 1 : n, (size_t)align);
+    }
 
-template <typename T>
-char* __default_alloc_template<T>::_end_free = nullptr;
+    static void *operator new[](size_t n, std::align_val_t align)
+    {
+        return Alloc::allocate_aligned(n == 0 ? 1 : n, (size_t)align);
+    }
 
-template <typename T>
-size_t __default_alloc_template<T>::_heap_size = 0;
+    static void operator delete(void *p, size_t n, std::align_val_t align)
+    {
+        if (p != 0)
+        {
+            Alloc::deallocate_aligned(p, n == 0 ? 1 : n, (size_t)align);
+        }
+    }
 
-template <typename T>
-typename  __default_alloc_template<T>::_Obj* volatile __default_alloc_template<T>::_free_list[__NFREELISTS]{
-        nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,nullptr
+    static void operator delete[](void *p, size_t n, std::align_val_t align)
+    {
+        if (p != 0)
+        {
+            Alloc::deallocate_aligned(p, n == 0 ? 1 : n, (size_t)align);
+        }
+    }
+#endif
 };
 
-template <typename T>
-std::mutex __default_alloc_template<T>::_mtx;
+//  二级配置器的标准分配器接口，可以直接交给std::vector等标准容器使用
+//  所有T的实例(包括容器rebind得到的)都转发给同一个按字节工作的__default_alloc_base，
+//  不同类型中大小落在同一个大小类的对象共用一组自由链表，整个程序只有一个内存池
+template<typename T>
+class __default_alloc_template
+{
+public:
+    using value_type = T;
+
+    //  默认构造函数，使用noexcept说明不会抛出异常。
+    constexpr __default_alloc_template() noexcept {}
+    //  拷贝构造函数
+    constexpr __default_alloc_template(const __default_alloc_template&) noexcept = default;
+    //  模板拷贝构造函数
+    template <class _Other>
+    constexpr __default_alloc_template(const __default_alloc_template<_Other>&) noexcept {}
+
+    //对象构造
+    void construct(T* __p, const T& val) {
+        new (__p) T(val);
+    }
+
+    //对象析构
+    void destory(T* __p) {
+        __p->~T();
+    }
+
+    //  开辟__n个T的内存空间，alignof(T)超过8字节时按T的对齐分配
+    T* allocate(size_t __n)
+    {
+        if (__n == 0)
+        {
+            return nullptr;
+        }
+        if (alignof(T) > 8)
+        {
+            return (T*)__default_alloc_base::allocate_aligned(__n * sizeof(T), alignof(T));
+        }
+        return (T*)__default_alloc_base::allocate(__n * sizeof(T));
+    }
+
+    //  释放__n个T的内存空间，__n与allocate时相同
+    void deallocate(T* __p, size_t __n)
+    {
+        if (__n == 0)
+        {
+            return;
+        }
+        if (alignof(T) > 8)
+        {
+            __default_alloc_base::deallocate_aligned(__p, __n * sizeof(T), alignof(T));
+            return;
+        }
+        __default_alloc_base::deallocate(__p, __n * sizeof(T));
+    }
+
+    //  内容扩充&缩容，大小以字节计
+    void *reallocate(void* __p, size_t __old_sz, size_t __new_sz)
+    {
+        return __default_alloc_base::reallocate(__p, __old_sz, __new_sz);
+    }
+};
 
+//  所有实例共用一个内存池，一个实例分配的内存可以由任何其他实例释放
+template <class T, class U>
+bool operator==(const __default_alloc_template<T>&, const __default_alloc_template<U>&) noexcept
+{
+    return true;
+}
 
+template <class T, class U>
+bool operator!=(const __default_alloc_template<T>&, const __default_alloc_template<U>&) noexcept
+{
+    return false;
+}
 
 #endif
\ No newline at end of file
@@ -1,9 +1,1263 @@
 #include "alloc.hpp"
 #include <vector>
+#include <list>
 #include <iostream>
+#include <cassert>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <csignal>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
-int main()
+//  __p是从内存池切分的对象
+static bool __in_pool(const void* __p)
 {
+    uint16_t __owner;
+    int __cls;
+    return __region_alloc::page_info(__p, __owner, __cls) && __cls >= 0;
+}
+
+//  整批分配的对象互不重叠、可以正常读写，整批释放后再次整批分配会复用同一批对象
+static void test_batch()
+{
+    const size_t __count = 1000;
+    const size_t __sizes[] = { 24, 200, 4096 };
+    for (size_t __s = 0; __s < sizeof(__sizes) / sizeof(__sizes[0]); __s++)
+    {
+        size_t __n = __sizes[__s];
+        std::vector<void*> __p(__count);
+        __default_alloc_base::allocate_batch(__n, __count, __p.data());
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            std::memset(__p[__i], (int)__i, __n);
+        }
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            assert(((unsigned char*)__p[__i])[0] == (unsigned char)__i);
+            assert(((unsigned char*)__p[__i])[__n - 1] == (unsigned char)__i);
+        }
+        std::set<void*> __first(__p.begin(), __p.end());
+        assert(__first.size() == __count);
+        __default_alloc_base::deallocate_batch(__n, __count, __p.data());
+        if (__n <= 200)
+        {
+            __default_alloc_base::allocate_batch(__n, __count, __p.data());
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                assert(__first.count(__p[__i]) == 1);
+            }
+            __default_alloc_base::deallocate_batch(__n, __count, __p.data());
+        }
+    }
+    std::cout << "batch: ok" << std::endl;
+}
+
+//  线程退出时本线程缓存和span中的对象归还给arena，之后别的线程分配同样大小的对象时取到的就是它们
+//  两个线程固定在同一个CPU上，打开CPU缓存时对象留在这个CPU的缓存中，结论相同
+static void test_thread_exit()
+{
+    cpu_set_t __saved;
+    assert(sched_getaffinity(0, sizeof(__saved), &__saved) == 0);
+    cpu_set_t __one;
+    CPU_ZERO(&__one);
+    CPU_SET(sched_getcpu(), &__one);
+    sched_setaffinity(0, sizeof(__one), &__one);
+
+    const size_t __count = 20;
+    const size_t __n = 104;
+    size_t __allocs = __default_alloc_base::stats().classes[__default_size_classes::index(__n)].allocations;
+    std::set<void*> __freed;
+    std::thread __t([&__freed, __n]()
+    {
+        std::vector<void*> __ptr(__count);
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __ptr[__i] = __default_alloc_base::allocate(__n);
+            __freed.insert(__ptr[__i]);
+        }
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __default_alloc_base::deallocate(__ptr[__i], __n);
+        }
+    });
+    __t.join();
+    //  退出线程的计数并入总数
+    assert(__default_alloc_base::stats().classes[__default_size_classes::index(__n)].allocations
+           == __allocs + __count);
+    //  span中没有用到的对象也还了回去，它们和线程缓存中的对象的先后顺序不确定，多取一些
+    std::vector<void*> __ptr(__count * 10);
+    size_t __reused = 0;
+    for (size_t __i = 0; __i < __ptr.size(); __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(__n);
+        __reused += __freed.count(__ptr[__i]);
+    }
+    assert(__reused == __count);
+    for (size_t __i = 0; __i < __ptr.size(); __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], __n);
+    }
+    sched_setaffinity(0, sizeof(__saved), &__saved);
+    std::cout << "thread exit: ok" << std::endl;
+}
+
+//  新线程第一次分配某个大小类时从内存池切下一段，之后的对象按地址顺序从这一段中逐个取出，
+//  新切出的内存还没有被用过，allocate_zeroed不用再清零；两个大小类都是别的测试没有用过的
+//  线程退出或者调用trim时，span中没有取出的对象串起来还给arena，下一次分配就能拿到它们
+static void test_spans()
+{
+    const size_t __exit_n = 1800;
+    const size_t __trim_n = 3000;
+    assert(__default_size_classes::index(__exit_n) != __default_size_classes::index(__trim_n));
+    std::set<void*> __rest;
+    void* __kept = 0;
+    std::thread __t([&__rest, &__kept, __exit_n]()
+    {
+        size_t __index = __default_size_classes::index(__exit_n);
+        size_t __size = __default_size_classes::size(__index);
+        __default_alloc_base::pool_stats __before = __default_alloc_base::stats();
+        char* __first = (char*)__default_alloc_base::allocate_zeroed(__exit_n);
+        __default_alloc_base::pool_stats __after = __default_alloc_base::stats();
+        assert(__after.classes[__index].refills == __before.classes[__index].refills + 1);
+        size_t __nobjs = (__after.classes[__index].carved_bytes - __before.classes[__index].carved_bytes) / __size;
+        assert(__nobjs > 2);
+        //  前一半按地址顺序取出并且都是0
+        std::vector<char*> __ptr(1, __first);
+        for (size_t __k = 1; __k < __nobjs / 2; __k++)
+        {
+            __ptr.push_back((char*)__default_alloc_base::allocate_zeroed(__exit_n));
+            assert(__ptr[__k] == __first + __k * __size);
+        }
+        for (size_t __k = 0; __k < __ptr.size(); __k++)
+        {
+            for (size_t __j = 0; __j < __exit_n; __j++)
+            {
+                assert(__ptr[__k][__j] == 0);
+            }
+        }
+        for (size_t __k = __nobjs / 2; __k < __nobjs; __k++)
+        {
+            __rest.insert(__first + __k * __size);
+        }
+        //  留下第一个对象，其余的释放，线程缓存中的对象和span的后一半都在线程退出时归还
+        for (size_t __k = 1; __k < __ptr.size(); __k++)
+        {
+            __default_alloc_base::deallocate(__ptr[__k], __exit_n);
+        }
+        __kept = __first;
+    });
+    __t.join();
+    std::vector<void*> __ptr;
+    size_t __reused = 0;
+    for (size_t __i = 0; __i < __rest.size() * 2; __i++)
+    {
+        __ptr.push_back(__default_alloc_base::allocate(__exit_n));
+        __reused += __rest.count(__ptr[__i]);
+    }
+    assert(__reused == __rest.size());
+    for (size_t __i = 0; __i < __ptr.size(); __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], __exit_n);
+    }
+    __default_alloc_base::deallocate(__kept, __exit_n);
+
+    //  trim归还调用线程的span：那个线程还没有退出，别的线程就能取到span中剩下的对象
+    std::atomic<int> __stage(0);
+    char* __first = 0;
+    size_t __nobjs = 0;
+    size_t __size = __default_size_classes::size(__default_size_classes::index(__trim_n));
+    std::thread __u([&__stage, &__first, &__nobjs, __trim_n, __size]()
+    {
+        size_t __index = __default_size_classes::index(__trim_n);
+        size_t __carved = __default_alloc_base::stats().classes[__index].carved_bytes;
+        __first = (char*)__default_alloc_base::allocate(__trim_n);
+        __nobjs = (__default_alloc_base::stats().classes[__index].carved_bytes - __carved) / __size;
+        __default_alloc_base::trim();
+        __stage = 1;
+        while (__stage != 2)
+        {
+            std::this_thread::yield();
+        }
+        __default_alloc_base::deallocate(__first, __trim_n);
+    });
+    while (__stage != 1)
+    {
+        std::this_thread::yield();
+    }
+    __ptr.clear();
+    for (size_t __k = 1; __k < __nobjs; __k++)
+    {
+        __ptr.push_back(__default_alloc_base::allocate(__trim_n));
+        assert((char*)__ptr.back() > __first && (char*)__ptr.back() < __first + __nobjs * __size);
+        assert((size_t)((char*)__ptr.back() - __first) % __size == 0);
+    }
+    assert(std::set<void*>(__ptr.begin(), __ptr.end()).size() == __ptr.size());
+    __stage = 2;
+    __u.join();
+    for (size_t __k = 0; __k < __ptr.size(); __k++)
+    {
+        __default_alloc_base::deallocate(__ptr[__k], __trim_n);
+    }
+    std::cout << "spans: ok" << std::endl;
+}
+
+//  多个线程同时整批分配、释放同一大小类的对象，线程缓存装不下的部分经全局自由链表来回传递
+//  一个对象同时被分给两个线程时，标记会被对方改写
+static void test_concurrent()
+{
+    const size_t __threads = 4;
+    const size_t __rounds = 200;
+    const size_t __count = 500;
+    const size_t __n = 48;
+    std::vector<std::thread> __t;
+    for (size_t __k = 0; __k < __threads; __k++)
+    {
+        __t.push_back(std::thread([__k, __n]()
+        {
+            std::vector<size_t*> __ptr(__count);
+            for (size_t __r = 0; __r < __rounds; __r++)
+            {
+                for (size_t __i = 0; __i < __count; __i++)
+                {
+                    __ptr[__i] = (size_t*)__default_alloc_base::allocate(__n);
+                    __ptr[__i][0] = __k;
+                    __ptr[__i][1] = __i;
+                }
+                for (size_t __i = 0; __i < __count; __i++)
+                {
+                    assert(__ptr[__i][0] == __k && __ptr[__i][1] == __i);
+                    __default_alloc_base::deallocate(__ptr[__i], __n);
+                }
+            }
+        }));
+    }
+    for (size_t __k = 0; __k < __threads; __k++)
+    {
+        __t[__k].join();
+    }
+    std::cout << "concurrent: ok" << std::endl;
+}
+
+//  每个大小都落在能放下它的最小大小类中，中等对象的大小类之间最多浪费25%
+//  中等对象也从内存池分配，usable_size就是大小类的大小
+static void test_size_classes()
+{
+    typedef __default_size_classes __classes;
+    for (size_t __i = 0; __i < (size_t)__classes::classes; __i++)
+    {
+        assert(__classes::index(__classes::size(__i)) == __i);
+        assert(__i == 0 || __classes::size(__i) > __classes::size(__i - 1));
+    }
+    assert(__classes::size(__classes::classes - 1) == (size_t)__classes::max_bytes);
+    for (size_t __n = 1; __n <= (size_t)__classes::max_bytes; __n++)
+    {
+        size_t __i = __classes::index(__n);
+        assert(__classes::size(__i) >= __n);
+        assert(__i == 0 || __classes::size(__i - 1) < __n);
+        assert(__n <= (size_t)__classes::small_bytes || __classes::size(__i) - __n < __n / 4);
+    }
+    const size_t __sizes[] = { 129, 300, 1000, 5000, 20000, 32768 };
+    for (size_t __s = 0; __s < sizeof(__sizes) / sizeof(__sizes[0]); __s++)
+    {
+        size_t __n = __sizes[__s];
+        void* __p = __default_alloc_base::allocate(__n);
+        assert(__in_pool(__p));
+        assert(__default_alloc_base::usable_size(__p) == __classes::size(__classes::index(__n)));
+        std::memset(__p, 1, __n);
+        __default_alloc_base::deallocate(__p, __n);
+    }
+    std::cout << "size classes: ok" << std::endl;
+}
+
+//  region按2MB对齐，开头是页表，切出的每一块都在页边界结束；剩下的不够时映射新的region
+//  内存池的对象都在region中，页表记着它们的大小类；一级配置器分配的大块内存不在region中
+static void test_regions()
+{
+    const size_t __region = __region_alloc::__REGION_SIZE;
+    const size_t __page = (size_t)1 << __region_alloc::__PAGE_SHIFT;
+    __region_alloc::cursor __c = { 0, 0 };
+    size_t __regions = __region_alloc::region_count();
+    size_t __got = 0;
+    char* __first = (char*)__region_alloc::allocate(__c, 0, 1000, 1000, __got);
+    size_t __first_got = __got;
+    assert(__first != 0 && __got >= 1000 && __got < 1000 + __page);
+    assert(((uintptr_t)__first + __got) % __page == 0);
+    char* __base = (char*)((uintptr_t)__first & ~(uintptr_t)(__region - 1));
+    assert(__first == __base + __region_alloc::__HEADER_BYTES);
+    assert(__region_alloc::node_of(__first) == 0);
+    assert(__region_alloc::region_count() == __regions + 1);
+    std::memset(__first, 1, __got);
+
+    //  同一个游标接着切，直到region剩下的不够为止
+    char* __second = (char*)__region_alloc::allocate(__c, 0, __region / 2, __region / 2, __got);
+    assert(__second == __first + __first_got);
+    assert(((uintptr_t)__second & ~(uintptr_t)(__region - 1)) == (uintptr_t)__base);
+    char* __third = (char*)__region_alloc::allocate(__c, 0, __region / 2, __region / 2, __got);
+    assert(((uintptr_t)__third & ~(uintptr_t)(__region - 1)) != (uintptr_t)__base);
+    assert(__region_alloc::region_count() == __regions + 2);
+
+    const size_t __sizes[] = { 8, 100, 3000 };
+    for (size_t __s = 0; __s < sizeof(__sizes) / sizeof(__sizes[0]); __s++)
+    {
+        void* __p = __default_alloc_base::allocate(__sizes[__s]);
+        uint16_t __owner;
+        int __cls;
+        assert(__region_alloc::page_info(__p, __owner, __cls));
+        assert(__cls == (int)__default_size_classes::index(__sizes[__s]));
+        __default_alloc_base::deallocate(__p, __sizes[__s]);
+    }
+    void* __big = __default_alloc_base::allocate(100000);
+    assert(__region_alloc::node_of(__big) < 0);
+    __default_alloc_base::deallocate(__big, 100000);
+    assert(__default_alloc_base::stats().region_count == __region_alloc::region_count());
+    std::cout << "regions: ok" << std::endl;
+}
+
+//  在每个可用的CPU上各起一个线程，它切分的对象来自本结点的region，由本结点的arena填充
+static void test_nodes()
+{
+    assert(__region_alloc::node_count() >= 1);
+    assert(__region_alloc::node_count() <= (int)__region_alloc::__MAX_NODES);
+    cpu_set_t __saved;
+    assert(sched_getaffinity(0, sizeof(__saved), &__saved) == 0);
+    const size_t __n = 2000;
+    for (int __cpu = 0; __cpu < CPU_SETSIZE; __cpu++)
+    {
+        if (!CPU_ISSET(__cpu, &__saved))
+        {
+            continue;
+        }
+        std::thread __t([__cpu, __n]()
+        {
+            cpu_set_t __one;
+            CPU_ZERO(&__one);
+            CPU_SET(__cpu, &__one);
+            sched_setaffinity(0, sizeof(__one), &__one);
+            int __node = __region_alloc::current_node();
+            assert(__node >= 0 && __node < __region_alloc::node_count());
+            void* __p = __default_alloc_base::allocate(__n);
+            assert(__region_alloc::node_of(__p) == __node);
+            assert(__default_alloc_base::refill_state(__n, __node).refills > 0);
+            __default_alloc_base::deallocate(__p, __n);
+        });
+        __t.join();
+    }
+    std::cout << "nodes: " << __region_alloc::node_count() << std::endl;
+}
+
+//  连续分配同一大小的对象时每次切分的个数翻倍，直到线程缓存的上限，chunk额外多要的部分也增长；
+//  其他大小类切分了很多次之后，这个大小类再切分时个数减半
+static void test_refill()
+{
+    const size_t __n = 640;
+    const size_t __count = 3000;
+    std::vector<void*> __ptr;
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr.push_back(__default_alloc_base::allocate(__n));
+    }
+    __default_alloc_base::refill_info __hot = __default_alloc_base::refill_state(__n);
+    assert(__hot.class_size == __n);
+    assert(__hot.batch > 8 && __hot.refills < __count / 8 / 2);
+    assert(__default_alloc_base::chunk_growth() > 16 * 1024);
+
+    std::vector<void*> __other;
+    for (size_t __i = 0; __i < 200000; __i++)
+    {
+        __other.push_back(__default_alloc_base::allocate(8 + __i % 16 * 8));
+    }
+    __default_alloc_base::refill_info __cold = __hot;
+    while (__cold.refills == __hot.refills)
+    {
+        __ptr.push_back(__default_alloc_base::allocate(__n));
+        __cold = __default_alloc_base::refill_state(__n);
+    }
+    assert(__cold.batch == __hot.batch / 2);
+    for (size_t __i = 0; __i < __other.size(); __i++)
+    {
+        __default_alloc_base::deallocate(__other[__i], 8 + __i % 16 * 8);
+    }
+    for (size_t __i = 0; __i < __ptr.size(); __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], __n);
+    }
+    std::cout << "refill: batch " << __hot.batch << " then " << __cold.batch << std::endl;
+}
+
+//  对齐不超过64字节的对象从自然对齐的大小类中取，仍在内存池中；更大的对齐或更大的对象交给一级配置器
+//  中间穿插普通分配，对齐不能是碰巧满足的
+static void test_aligned()
+{
+    const size_t __aligns[] = { 16, 32, 64, 128, 4096 };
+    const size_t __sizes[] = { 1, 24, 100, 1000, 5000, 40000 };
+    const size_t __count = 50;
+    for (size_t __a = 0; __a < sizeof(__aligns) / sizeof(__aligns[0]); __a++)
+    {
+        for (size_t __s = 0; __s < sizeof(__sizes) / sizeof(__sizes[0]); __s++)
+        {
+            size_t __align = __aligns[__a];
+            size_t __n = __sizes[__s];
+            std::vector<void*> __ptr(__count);
+            std::vector<void*> __plain(__count);
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                __plain[__i] = __default_alloc_base::allocate(24);
+                __ptr[__i] = __default_alloc_base::allocate_aligned(__n, __align);
+                assert(((uintptr_t)__ptr[__i] & (__align - 1)) == 0);
+                assert(__default_alloc_base::usable_size(__ptr[__i]) >= __n);
+                assert(__in_pool(__ptr[__i]) == (__align <= 64 && __n <= 32768));
+                std::memset(__ptr[__i], 1, __n);
+            }
+            for (size_t __i = 0; __i < __count; __i++)
+            {
+                __default_alloc_base::deallocate_aligned(__ptr[__i], __n, __align);
+                __default_alloc_base::deallocate(__plain[__i], 24);
+            }
+        }
+    }
+    std::cout << "aligned: ok" << std::endl;
+}
+
+//  标准分配器接口：不同T的实例相等，容器rebind之后的节点也从内存池分配；
+//  一种类型释放的对象，另一种同样大小的类型接着就能取到，说明所有T共用一组自由链表
+//  固定在当前CPU上，打开CPU缓存时两次操作在同一个CPU的缓存上
+struct __std_alloc_item
+{
+    double _M_a;
+    double _M_b;
+    double _M_c;
+};
+
+static void test_std_alloc()
+{
+    __default_alloc_template<int> __ints;
+    __default_alloc_template<double> __doubles(__ints);
+    assert(__ints == __doubles && !(__ints != __doubles));
+    static_assert(std::is_same<std::allocator_traits<__default_alloc_template<int> >
+                               ::rebind_alloc<double>, __default_alloc_template<double> >::value,
+                  "rebind must give __default_alloc_template<U>");
+
+    std::list<int, __default_alloc_template<int> > __a;
+    std::list<int, __default_alloc_template<int> > __b;
+    for (int __i = 0; __i < 1000; __i++)
+    {
+        __a.push_back(__i);
+    }
+    assert(__in_pool(&__a.back()));
+    __b.splice(__b.end(), __a);
+    assert(__a.empty() && __b.size() == 1000 && __b.back() == 999);
+
+    cpu_set_t __saved;
+    assert(sched_getaffinity(0, sizeof(__saved), &__saved) == 0);
+    cpu_set_t __one;
+    CPU_ZERO(&__one);
+    CPU_SET(sched_getcpu(), &__one);
+    sched_setaffinity(0, sizeof(__one), &__one);
+    __default_alloc_template<__std_alloc_item> __items;
+    __default_alloc_template<char> __chars;
+    __std_alloc_item* __item = __items.allocate(1);
+    __items.deallocate(__item, 1);
+    char* __c = __chars.allocate(sizeof(__std_alloc_item));
+    assert((void*)__c == (void*)__item);
+    __chars.deallocate(__c, sizeof(__std_alloc_item));
+    sched_setaffinity(0, sizeof(__saved), &__saved);
+    std::cout << "std alloc: ok" << std::endl;
+}
+
+//  回收函数按调用顺序记下自己的编号
+static int __reclaim_order[16];
+static size_t __reclaim_calls = 0;
+//  内存不足时由回收函数释放的备用内存
+static void* __reclaim_reserve = 0;
+static const size_t __RESERVE_BYTES = 512 * 1024 * 1024;
+
+static size_t __reclaim_early(size_t)
+{
+    __reclaim_order[__reclaim_calls++] = 1;
+    return 100;
+}
+
+static size_t __reclaim_middle(size_t)
+{
+    __reclaim_order[__reclaim_calls++] = 2;
+    return 100;
+}
+
+static size_t __reclaim_late(size_t)
+{
+    __reclaim_order[__reclaim_calls++] = 3;
+    return 0;
+}
+
+static size_t __reclaim_reserve_free(size_t)
+{
+    if (__reclaim_reserve == 0)
+    {
+        return 0;
+    }
+    __malloc_alloc_template::deallocate(__reclaim_reserve);
+    __reclaim_reserve = 0;
+    return __RESERVE_BYTES;
+}
+
+//  回收函数按优先级从小到大调用，优先级相同的按注册顺序，释放够了就停止；
+//  realloc失败时回收之后重试，返回新的地址，原来的内容保留
+static void test_reclaimers()
+{
+    assert(__malloc_alloc_template::add_reclaimer(__reclaim_late, 10, "late"));
+    assert(__malloc_alloc_template::add_reclaimer(__reclaim_early, -5, "early"));
+    assert(__malloc_alloc_template::add_reclaimer(__reclaim_middle, -5, "middle"));
+    __malloc_alloc_template::reclaimer_info __info[16];
+    size_t __count = __malloc_alloc_template::reclaimers(__info, 16);
+    assert(__count >= 4 && __count <= 16);
+    assert(std::string(__info[0].name) == "early" && std::string(__info[1].name) == "middle");
+    assert(std::string(__info[__count - 1].name) == "late");
+    for (size_t __i = 1; __i < __count; __i++)
+    {
+        assert(__info[__i - 1].priority <= __info[__i].priority);
+    }
+
+    __reclaim_calls = 0;
+    __malloc_alloc_template::reclaim(0);
+    assert(__reclaim_calls == 3);
+    assert(__reclaim_order[0] == 1 && __reclaim_order[1] == 2 && __reclaim_order[2] == 3);
+    __reclaim_calls = 0;
+    assert(__malloc_alloc_template::reclaim(150) == 200);
+    assert(__reclaim_calls == 2);
+    __malloc_alloc_template::reclaimers(__info, 16);
+    assert(__info[0].calls == 2 && __info[0].bytes_freed == 200);
+    assert(__info[__count - 1].calls == 1);
+    assert(__malloc_alloc_template::remove_reclaimer(__reclaim_early));
+    assert(__malloc_alloc_template::remove_reclaimer(__reclaim_middle));
+    assert(__malloc_alloc_template::remove_reclaimer(__reclaim_late));
+    assert(!__malloc_alloc_template::remove_reclaimer(__reclaim_late));
+
+    //  大小为0时释放并返回0
+    void* __p = __malloc_alloc_template::allocate(100);
+    assert(__malloc_alloc_template::reallocate(__p, 0) == 0);
+
+    //  子进程限制地址空间，realloc失败后由回收函数释放备用内存再重试
+    //  新的大小超过malloc线程堆的上限，一定要新映射内存，不会在已经预留的地址空间里满足
+    pid_t __pid = fork();
+    if (__pid == 0)
+    {
+        __reclaim_reserve = __malloc_alloc_template::allocate(__RESERVE_BYTES);
+        __malloc_alloc_template::add_reclaimer(__reclaim_reserve_free, -10, "reserve");
+        char __buf[128];
+        int __fd = open("/proc/self/statm", O_RDONLY);
+        ssize_t __len = read(__fd, __buf, sizeof(__buf) - 1);
+        close(__fd);
+        __buf[__len > 0 ? __len : 0] = 0;
+        struct rlimit __limit;
+        __limit.rlim_cur = __limit.rlim_max
+            = strtoull(__buf, 0, 10) * (size_t)sysconf(_SC_PAGESIZE) + 16 * 1024 * 1024;
+        setrlimit(RLIMIT_AS, &__limit);
+        char* __q = (char*)__malloc_alloc_template::allocate(100);
+        std::memset(__q, 'x', 100);
+        size_t __oom = __malloc_alloc_template::stats().oom_calls;
+        __q = (char*)__malloc_alloc_template::reallocate(__q, __RESERVE_BYTES / 2);
+        bool __ok = __q != 0 && __q[0] == 'x' && __q[99] == 'x' && __reclaim_reserve == 0
+                    && __malloc_alloc_template::stats().oom_calls == __oom + 1;
+        _exit(__ok ? 0 : 1);
+    }
+    int __status = 0;
+    waitpid(__pid, &__status, 0);
+    assert(WIFEXITED(__status) && WEXITSTATUS(__status) == 0);
+    std::cout << "reclaimers: ok" << std::endl;
+}
+
+//  不带大小的free/realloc/usable_size靠page map找到大小类，大块内存交给一级配置器
+static void test_malloc_api()
+{
+    char* __p = (char*)__default_alloc_base::malloc(20);
+    assert(__default_alloc_base::usable_size(__p) >= 20);
+    std::memset(__p, 'x', 20);
+    __p = (char*)__default_alloc_base::realloc(__p, 100000);
+    assert(__p[0] == 'x' && __p[19] == 'x');
+    assert(__default_alloc_base::usable_size(__p) >= 100000);
+    __p = (char*)__default_alloc_base::realloc(__p, 50);
+    assert(__p[0] == 'x' && __p[19] == 'x');
+    assert(__default_alloc_base::usable_size(__p) >= 50);
+    __default_alloc_base::free(__p);
+    __default_alloc_base::free(0);
+    assert(__default_alloc_base::usable_size(0) == 0);
+
+    int* __z = (int*)__default_alloc_base::calloc(100, sizeof(int));
+    for (int __i = 0; __i < 100; __i++)
+    {
+        assert(__z[__i] == 0);
+    }
+    __default_alloc_base::free(__z);
+
+    //  传入的大小超过对象所在的大小类时终止程序，而不是把对象挂到错误的自由链表上
+    void* __small = __default_alloc_base::allocate(16);
+    pid_t __pid = fork();
+    if (__pid == 0)
+    {
+        close(STDERR_FILENO);
+        __default_alloc_base::deallocate(__small, 256);
+        _exit(0);
+    }
+    int __status = 0;
+    waitpid(__pid, &__status, 0);
+    assert(WIFSIGNALED(__status) && WTERMSIG(__status) == SIGABRT);
+    __default_alloc_base::deallocate(__small, 16);
+    std::cout << "malloc api: ok" << std::endl;
+}
+
+//  pooled<T>的派生类用new创建时从内存池分配，通过基类指针delete时按实际大小释放
+struct __pooled_base : pooled<__pooled_base>
+{
+    int _M_a;
+    virtual ~__pooled_base() {}
+};
+
+struct __pooled_derived : __pooled_base
+{
+    char _M_pad[200];
+};
+
+struct alignas(64) __pooled_aligned : pooled<__pooled_aligned>
+{
+    char _M_data[64];
+};
+
+//  派生类比基类对齐要求更高：基类只要8字节对齐，派生类要16字节(默认对齐)或64字节(超过默认对齐)
+struct __pooled_wide : __pooled_base
+{
+    long double _M_value;
+};
+
+//  arena只保证8字节对齐，基类从arena分配时更能看出派生类的对齐有没有被满足
+struct __arena_pooled_base : pooled<__arena_pooled_base, __arena_alloc>
+{
+    int _M_a;
+    virtual ~__arena_pooled_base() {}
+};
+
+struct __arena_pooled_wide : __arena_pooled_base
+{
+    long double _M_value;
+};
+
+#ifdef __cpp_aligned_new
+struct alignas(64) __pooled_over_aligned : __pooled_base
+{
+    char _M_data[64];
+};
+#endif
+
+static void test_pooled()
+{
+    __pooled_base* __b = new __pooled_derived;
+    assert(__in_pool(__b));
+    assert(__default_alloc_base::usable_size(__b) >= sizeof(__pooled_derived));
+    delete __b;
+
+    __pooled_base* __arr = new __pooled_base[10];
+    assert(__in_pool(__arr));
+    delete[] __arr;
+
+    __pooled_aligned* __al = new __pooled_aligned;
+    assert(((uintptr_t)__al & 63) == 0);
+    delete __al;
+
+    for (int __i = 0; __i < 100; __i++)
+    {
+        __pooled_base* __w = new __pooled_wide;
+        assert(((uintptr_t)__w & (alignof(__pooled_wide) - 1)) == 0);
+        delete __w;
+    }
+    {
+        __monotonic_arena __a;
+        __arena_alloc::scope __s(__a);
+        for (int __i = 0; __i < 100; __i++)
+        {
+            __arena_alloc::allocate(8);
+            __arena_pooled_base* __w = new __arena_pooled_wide;
+            assert(((uintptr_t)__w & (alignof(__arena_pooled_wide) - 1)) == 0);
+            delete __w;
+        }
+    }
+#ifdef __cpp_aligned_new
+    for (int __i = 0; __i < 100; __i++)
+    {
+        __pooled_base* __o = new __pooled_over_aligned;
+        assert(((uintptr_t)__o & 63) == 0);
+        delete __o;
+    }
+#endif
+
+    __pooled_base* __nt = new (std::nothrow) __pooled_base;
+    assert(__nt != 0 && __in_pool(__nt));
+    delete __nt;
+    std::cout << "pooled: ok" << std::endl;
+}
+
+//  allocate_zeroed无论取到新切分的对象还是被写过又释放的对象，内容都要全为0
+static void test_zeroed()
+{
+    const size_t __sizes[] = { 8, 72, 512, 100000 };
+    for (size_t __s = 0; __s < sizeof(__sizes) / sizeof(__sizes[0]); __s++)
+    {
+        size_t __n = __sizes[__s];
+        std::vector<char*> __p(300);
+        for (int __round = 0; __round < 2; __round++)
+        {
+            for (size_t __i = 0; __i < __p.size(); __i++)
+            {
+                __p[__i] = (char*)__default_alloc_base::allocate_zeroed(__n);
+                for (size_t __j = 0; __j < __n; __j++)
+                {
+                    assert(__p[__i][__j] == 0);
+                }
+                std::memset(__p[__i], 0xff, __n);
+            }
+            for (size_t __i = 0; __i < __p.size(); __i++)
+            {
+                __default_alloc_base::deallocate(__p[__i], __n);
+            }
+        }
+    }
+    std::cout << "zeroed: ok" << std::endl;
+}
+
+//  大小类表不同的两个二级配置器在同一个进程中交替使用，各自的页表编号不能混在一起：
+//  每个对象的usable_size都要不小于申请的大小，全部按不带大小的free释放也不能被当成非法释放
+typedef __basic_default_alloc<__size_classes<16, 256, 2, 65536> > __wide_alloc;
+
+static void test_two_policies()
+{
+    const size_t __count = 20000;
+    std::vector<char*> __a(__count);
+    std::vector<char*> __b(__count);
+    std::vector<size_t> __size(__count);
+    unsigned __seed = 7;
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __seed = __seed * 1103515245 + 12345;
+        __size[__i] = 1 + (__seed >> 8) % 2000;
+        __a[__i] = (char*)__default_alloc_base::malloc(__size[__i]);
+        __b[__i] = (char*)__wide_alloc::malloc(__size[__i]);
+        std::memset(__a[__i], 'a', __size[__i]);
+        std::memset(__b[__i], 'b', __size[__i]);
+    }
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        assert(__default_alloc_base::usable_size(__a[__i]) >= __size[__i]);
+        assert(__wide_alloc::usable_size(__b[__i]) >= __size[__i]);
+        assert(__a[__i][0] == 'a' && __a[__i][__size[__i] - 1] == 'a');
+        assert(__b[__i][0] == 'b' && __b[__i][__size[__i] - 1] == 'b');
+        __default_alloc_base::free(__a[__i]);
+        __wide_alloc::free(__b[__i]);
+    }
+    __default_alloc_base::trim();
+    __wide_alloc::trim();
+    std::cout << "two policies: ok" << std::endl;
+}
+
+//  simple_alloc按编译期下标分配单个对象时，分配记录中也要是请求的大小，而不是大小类的大小
+struct __traced_node
+{
+    char _M_data[20];
+};
+
+static void test_trace_size()
+{
+    const char* __path = "/tmp/alloc_test_trace.bin";
+    assert(__alloc_trace::start(__path));
+    __traced_node* __p = simple_alloc<__traced_node, __default_alloc_base>::allocate();
+    simple_alloc<__traced_node, __default_alloc_base>::deallocate(__p);
+    __alloc_trace::stop();
+
+    FILE* __f = fopen(__path, "rb");
+    assert(__f != 0);
+    __alloc_trace::file_header __h;
+    assert(fread(&__h, sizeof(__h), 1, __f) == 1);
+    __alloc_trace::record __r;
+    size_t __records = 0;
+    while (fread(&__r, sizeof(__r), 1, __f) == 1)
+    {
+        assert(__r.size == sizeof(__traced_node));
+        __records++;
+    }
+    fclose(__f);
+    unlink(__path);
+    assert(__records == 2);
+    std::cout << "trace size: ok" << std::endl;
+}
+
+//  线程退出时单线程配置器里的空闲对象交给之后的线程：新线程分配同样大小的对象时直接复用它们，不再向region申请
+static void test_single_thread_exit()
+{
+    const size_t __count = 1000;
+    std::set<void*> __freed;
+    std::thread __a([&__freed]()
+    {
+        std::vector<void*> __ptr(__count);
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __ptr[__i] = __single_thread_alloc::allocate(200);
+            std::memset(__ptr[__i], 1, 200);
+        }
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __single_thread_alloc::deallocate(__ptr[__i], 200);
+            __freed.insert(__ptr[__i]);
+        }
+    });
+    __a.join();
+    std::thread __b([&__freed]()
+    {
+        size_t __reused = 0;
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            char* __p = (char*)__single_thread_alloc::allocate_zeroed(200);
+            for (size_t __j = 0; __j < 200; __j++)
+            {
+                assert(__p[__j] == 0);
+            }
+            __reused += __freed.count(__p);
+        }
+        //  退出线程内存池剩下的部分也切成了对象，其中最多有一个属于这个大小类
+        assert(__reused + 1 >= __count);
+        assert(__single_thread_alloc::heap_size() == 0);
+    });
+    __b.join();
+    std::cout << "single thread exit: ok" << std::endl;
+}
+
+//  rollback之后分配的内存回到mark的位置重新使用，超出的block归还；scope内__arena_alloc使用绑定的arena
+static void test_arena()
+{
+    __monotonic_arena __a;
+    void* __first = __a.allocate(100);
+    __monotonic_arena::mark __m = __a.get_mark();
+    void* __second = __a.allocate(100);
+    assert((char*)__second >= (char*)__first + 100);
+    size_t __reserved = __a.reserved();
+    for (int __i = 0; __i < 100; __i++)
+    {
+        std::memset(__a.allocate(4000), 1, 4000);
+    }
+    void* __big = __a.allocate(1 << 20, 64);
+    assert(((uintptr_t)__big & 63) == 0);
+    assert(__a.reserved() > __reserved);
+    __a.rollback(__m);
+    assert(__a.reserved() == __reserved);
+    assert(__a.allocate(100) == __second);
+
+    //  只释放最后一次分配时指针退回去
+    void* __last = __a.allocate(48);
+    __a.deallocate(__last, 48);
+    assert(__a.allocate(48) == __last);
+
+    __a.reset();
+    assert(__a.reserved() > 0);
+    {
+        __arena_alloc::scope __s(__a);
+        assert(&__arena_alloc::arena() == &__a);
+        void* __p = __arena_alloc::allocate(64);
+        __arena_alloc::deallocate(__p, 64);
+        assert(__arena_alloc::allocate(64) == __p);
+    }
+    assert(&__arena_alloc::arena() != &__a);
+    __a.release();
+    assert(__a.reserved() == 0);
+    std::cout << "arena: ok" << std::endl;
+}
+
+#ifdef __ALLOC_HAS_PMR
+//  std::pmr容器通过适配器从内存池和arena分配，超过8字节的对齐也要满足
+static void test_pmr()
+{
+    std::pmr::memory_resource* __pool = __pool_resource<__default_alloc_base>::instance();
+    assert(__pool->is_equal(*__pool_resource<__default_alloc_base>::instance()));
+    {
+        std::pmr::vector<int> __v(__pool);
+        for (int __i = 0; __i < 1000; __i++)
+        {
+            __v.push_back(__i);
+        }
+        assert(__v[999] == 999);
+    }
+    void* __p = __pool->allocate(100, 64);
+    assert(((uintptr_t)__p & 63) == 0);
+    __pool->deallocate(__p, 100, 64);
+
+    __monotonic_arena __a;
+    __arena_resource __r(__a);
+    __arena_resource __other(__a);
+    assert(__r.is_equal(__other) && !__r.is_equal(*__pool));
+    {
+        std::pmr::vector<std::pmr::string> __v(&__r);
+        for (int __i = 0; __i < 100; __i++)
+        {
+            __v.emplace_back(64, 'a');
+        }
+        assert(__v[99].size() == 64 && __v[99].get_allocator().resource() == &__r);
+    }
+    assert(__a.reserved() > 0);
+    std::cout << "pmr: ok" << std::endl;
+}
+#endif
+
+//  本线程分配、另一个线程释放的对象进入本线程的远程释放队列，
+//  trim要把它们取回来，这些对象所在的chunk才能被认为是空闲的
+static void test_remote_free()
+{
+    const size_t __count = 4000;
+    const size_t __n = 1000;
+    std::vector<void*> __ptr(__count);
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(__n);
+        std::memset(__ptr[__i], 1, __n);
+    }
+    std::thread __t([&__ptr, __n]()
+    {
+        for (size_t __i = 0; __i < __ptr.size(); __i++)
+        {
+            __default_alloc_base::deallocate(__ptr[__i], __n);
+        }
+    });
+    __t.join();
+    size_t __released = __default_alloc_base::trim();
+    std::cout << "remote free: released " << __released << std::endl;
+    assert(__released >= __count * __n / 2);
+}
+
+#ifdef __ALLOC_HAS_RSEQ
+//  子进程关掉glibc的rseq注册之后运行：CPU编号读出来是负数，分配和释放退回线程缓存
+//  两个线程固定在同一个CPU上，一个线程释放的对象留在它自己的线程缓存中，另一个线程取不到
+static void test_no_rseq()
+{
+    assert(__rseq_size == 0);
+    cpu_set_t __one;
+    CPU_ZERO(&__one);
+    CPU_SET(sched_getcpu(), &__one);
+    sched_setaffinity(0, sizeof(__one), &__one);
+    const size_t __count = 20;
+    const size_t __n = 104;
+    std::atomic<int> __stage(0);
+    std::set<void*> __freed;
+    std::thread __t([&__stage, &__freed, __n]()
+    {
+        std::vector<void*> __ptr(__count);
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __ptr[__i] = __default_alloc_base::allocate(__n);
+            std::memset(__ptr[__i], 1, __n);
+            __freed.insert(__ptr[__i]);
+        }
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __default_alloc_base::deallocate(__ptr[__i], __n);
+        }
+        __stage = 1;
+        while (__stage != 2)
+        {
+            std::this_thread::yield();
+        }
+    });
+    while (__stage != 1)
+    {
+        std::this_thread::yield();
+    }
+    std::vector<void*> __ptr(__count);
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(__n);
+        assert(__freed.count(__ptr[__i]) == 0);
+    }
+    __stage = 2;
+    __t.join();
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], __n);
+    }
+    __default_alloc_base::pool_stats __s = __default_alloc_base::stats();
+    size_t __index = __default_size_classes::index(__n);
+    assert(__s.classes[__index].allocations == __count * 2);
+    assert(__s.classes[__index].frees == __count * 2);
+    __default_alloc_base::trim();
+    std::cout << "no rseq: ok" << std::endl;
+}
+
+//  用GLIBC_TUNABLES关掉rseq重新运行自己，在子进程中检查退回线程缓存的路径
+static void test_rseq_fallback(const char* __self)
+{
+    pid_t __pid = fork();
+    if (__pid == 0)
+    {
+        setenv("GLIBC_TUNABLES", "glibc.pthread.rseq=0", 1);
+        execl("/proc/self/exe", __self, "no-rseq", (char*)0);
+        _exit(127);
+    }
+    int __status = 0;
+    waitpid(__pid, &__status, 0);
+    assert(WIFEXITED(__status) && WEXITSTATUS(__status) == 0);
+}
+
+//  另一个线程在别的CPU上释放的对象留在那个CPU的缓存中，trim要把所有CPU的缓存清空，它们所在的chunk才能释放
+//  只有一个CPU可用时两个线程在同一个CPU上，测的是当前CPU的情况
+static void test_cpu_drain()
+{
+    cpu_set_t __saved;
+    assert(sched_getaffinity(0, sizeof(__saved), &__saved) == 0);
+    int __first = -1;
+    int __last = -1;
+    for (int __cpu = 0; __cpu < CPU_SETSIZE; __cpu++)
+    {
+        if (CPU_ISSET(__cpu, &__saved))
+        {
+            __last = __cpu;
+            if (__first < 0)
+            {
+                __first = __cpu;
+            }
+        }
+    }
+    const size_t __count = 2000;
+    const size_t __n = 3000;
+    std::thread __t([__last, __n]()
+    {
+        cpu_set_t __one;
+        CPU_ZERO(&__one);
+        CPU_SET(__last, &__one);
+        sched_setaffinity(0, sizeof(__one), &__one);
+        std::vector<void*> __ptr(__count);
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __ptr[__i] = __default_alloc_base::allocate(__n);
+            std::memset(__ptr[__i], 1, __n);
+        }
+        for (size_t __i = 0; __i < __count; __i++)
+        {
+            __default_alloc_base::deallocate(__ptr[__i], __n);
+        }
+    });
+    __t.join();
+    cpu_set_t __one;
+    CPU_ZERO(&__one);
+    CPU_SET(__first, &__one);
+    sched_setaffinity(0, sizeof(__one), &__one);
+    size_t __released = __default_alloc_base::trim();
+    sched_setaffinity(0, sizeof(__saved), &__saved);
+    std::cout << "cpu drain: released " << __released << std::endl;
+    assert(__released >= __count * __n / 4 * 3);
+}
+#endif
+
+//  同一大小的对象全部释放之后trim应当归还内存，之后还能继续从池中分配
+static void test_trim()
+{
+    const size_t __count = 100000;
+    std::vector<void*> __ptr(__count);
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(64);
+        std::memset(__ptr[__i], 1, 64);
+    }
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], 64);
+    }
+    size_t __released = __default_alloc_base::trim();
+    std::cout << "trim: released " << __released << std::endl;
+    assert(__released >= __count * 64 / 2);
+    //  没有新的空闲chunk时不再归还
+    assert(__default_alloc_base::trim() == 0);
+    void* __p = __default_alloc_base::allocate(64);
+    std::memset(__p, 2, 64);
+    __default_alloc_base::deallocate(__p, 64);
+}
+
+//  分配/释放次数按调用累计，trim不改变它们；trim之后内存池减小的字节数不少于归还的字节数
+//  (chunk首尾不满一页的部分留着不归还，但整个chunk都不再算在内存池中)，高水位不变，
+//  被归还的chunk中的对象不再算作空闲对象；一级配置器按调用次数和请求的字节数统计
+static void test_stats()
+{
+    const size_t __count = 50000;
+    const size_t __n = 72;
+    const size_t __index = __default_size_classes::index(__n);
+    __default_alloc_base::pool_stats __s0 = __default_alloc_base::stats();
+    std::vector<void*> __ptr(__count);
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(__n);
+    }
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], __n);
+    }
+    __default_alloc_base::pool_stats __s1 = __default_alloc_base::stats();
+    assert(__s1.classes[__index].class_size == __default_size_classes::size(__index));
+    assert(__s1.classes[__index].allocations == __s0.classes[__index].allocations + __count);
+    assert(__s1.classes[__index].frees == __s0.classes[__index].frees + __count);
+    assert(__s1.classes[__index].free_objects >= __count);
+    assert(__s1.classes[__index].carved_bytes >= __count * __s1.classes[__index].class_size);
+    assert(__s1.heap_peak >= __s1.heap_size && __s1.chunk_count > 0 && __s1.region_count > 0);
+
+    size_t __released = __default_alloc_base::trim();
+    __default_alloc_base::pool_stats __s2 = __default_alloc_base::stats();
+    assert(__released > 0);
+    assert(__s1.heap_size - __s2.heap_size >= __released);
+    assert(__s2.heap_peak == __s1.heap_peak);
+    assert(__s2.classes[__index].allocations == __s1.classes[__index].allocations);
+    assert(__s2.classes[__index].frees == __s1.classes[__index].frees);
+    assert(__s2.classes[__index].free_objects < __s1.classes[__index].free_objects);
+    size_t __free_bytes = __s2.pool_bytes;
+    for (size_t __i = 0; __i < sizeof(__s2.classes) / sizeof(__s2.classes[0]); __i++)
+    {
+        __free_bytes += __s2.classes[__i].free_objects * __s2.classes[__i].class_size;
+    }
+    assert(__free_bytes <= __s2.heap_size);
+
+    __malloc_alloc_template::malloc_stats __m0 = __malloc_alloc_template::stats();
+    void* __big = __default_alloc_base::allocate(100000);
+    __big = __default_alloc_base::reallocate(__big, 100000, 200000);
+    __default_alloc_base::deallocate(__big, 200000);
+    __malloc_alloc_template::malloc_stats __m1 = __malloc_alloc_template::stats();
+    assert(__m1.allocations == __m0.allocations + 1);
+    assert(__m1.reallocations == __m0.reallocations + 1);
+    assert(__m1.frees == __m0.frees + 1);
+    assert(__m1.bytes_requested == __m0.bytes_requested + 300000);
+    std::cout << "stats: released " << __released << std::endl;
+}
+
+//  按奇偶交错的顺序释放，自由链表中来自不同chunk的对象相互穿插，留一个对象让它所在的chunk不能释放
+//  第一次trim释放chunk时不能把链表中排在后面、属于其他chunk的对象丢掉：
+//  最后一个对象释放之后，第二次trim应当能把剩下的chunk也还给系统，之后还能正常分配
+static void test_trim_interleaved()
+{
+    const size_t __count = 200000;
+    std::vector<void*> __ptr(__count);
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(64);
+        std::memset(__ptr[__i], 1, 64);
+    }
+    const size_t __kept = __count / 2 + 1;
+    for (size_t __i = 1; __i < __count; __i += 2)
+    {
+        if (__i != __kept)
+        {
+            __default_alloc_base::deallocate(__ptr[__i], 64);
+        }
+    }
+    for (size_t __i = 0; __i < __count; __i += 2)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], 64);
+    }
+    size_t __first = __default_alloc_base::trim();
+    __default_alloc_base::deallocate(__ptr[__kept], 64);
+    size_t __second = __default_alloc_base::trim();
+    std::cout << "trim interleaved: released " << __first << " then " << __second << std::endl;
+    assert(__first >= __count * 64 / 2);
+    assert(__second > 0);
+    //  被释放chunk中的对象不再计入空闲对象
+    __default_alloc_base::pool_stats __s = __default_alloc_base::stats();
+    size_t __free_bytes = 0;
+    for (size_t __i = 0; __i < sizeof(__s.classes) / sizeof(__s.classes[0]); __i++)
+    {
+        __free_bytes += __s.classes[__i].free_objects * __s.classes[__i].class_size;
+    }
+    assert(__free_bytes <= __s.heap_size);
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __ptr[__i] = __default_alloc_base::allocate(64);
+        std::memset(__ptr[__i], 2, 64);
+    }
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], 64);
+    }
+}
+
+//  trim释放一部分chunk之后，新的分配会复用它们，这些chunk两侧的chunk中还有正在使用的对象：
+//  复用的chunk切分时不能改写相邻chunk对象所在页的大小类，所有对象的usable_size都要不小于申请的大小
+static void test_trim_reuse()
+{
+    const size_t __count = 100000;
+    std::vector<void*> __ptr(2 * __count);
+    std::vector<size_t> __size(2 * __count);
+    unsigned __seed = 3;
+    for (size_t __i = 0; __i < 2 * __count; __i++)
+    {
+        __seed = __seed * 1103515245 + 12345;
+        __size[__i] = 8 + (__seed >> 8) % 2000;
+        if (__i == __count)
+        {
+            //  前一半中每隔一段留一个对象，让被释放的chunk和仍在使用的chunk交错
+            for (size_t __j = 0; __j < __count; __j++)
+            {
+                if (__j % 5000 != 0)
+                {
+                    __default_alloc_base::deallocate(__ptr[__j], __size[__j]);
+                    __ptr[__j] = 0;
+                }
+            }
+            __default_alloc_base::trim();
+        }
+        if (__i < __count || __ptr[__i] == 0)
+        {
+            __ptr[__i] = __default_alloc_base::allocate(__size[__i]);
+            std::memset(__ptr[__i], 1, __size[__i]);
+        }
+    }
+    for (size_t __j = 0; __j < __count; __j++)
+    {
+        if (__ptr[__j] == 0)
+        {
+            __ptr[__j] = __default_alloc_base::allocate(__size[__j]);
+        }
+    }
+    for (size_t __i = 0; __i < 2 * __count; __i++)
+    {
+        assert(__default_alloc_base::usable_size(__ptr[__i]) >= __size[__i]);
+        __default_alloc_base::deallocate(__ptr[__i], __size[__i]);
+    }
+    std::cout << "trim reuse: ok" << std::endl;
+}
+
+//  混合大小的对象全部释放之后，trim应当把绝大部分内存池还给系统
+//  对齐和凑整页时跳过的字节也要算作空闲，否则几乎每个chunk都差几十个字节而不能释放
+static void test_trim_mixed()
+{
+    const size_t __count = 200000;
+    std::vector<void*> __ptr(__count);
+    std::vector<size_t> __size(__count);
+    unsigned __seed = 1;
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __seed = __seed * 1103515245 + 12345;
+        __size[__i] = 8 + (__seed >> 8) % 393;
+        __ptr[__i] = __default_alloc_base::allocate(__size[__i]);
+        std::memset(__ptr[__i], 1, __size[__i]);
+    }
+    size_t __heap = __default_alloc_base::stats().heap_size;
+    for (size_t __i = 0; __i < __count; __i++)
+    {
+        __default_alloc_base::deallocate(__ptr[__i], __size[__i]);
+    }
+    size_t __released = __default_alloc_base::trim();
+    std::cout << "trim: heap " << __heap << " released " << __released << std::endl;
+    assert(__released >= __heap / 4 * 3);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "no-rseq")
+    {
+#ifdef __ALLOC_HAS_RSEQ
+        test_no_rseq();
+#endif
+        return 0;
+    }
     std::vector<int, __default_alloc_template<int>> vec;
     for (int i = 0; i < 100; i++)
     {
@@ -12,5 +1266,36 @@ int main()
     for (int val : vec) {
         std::cout << val <<"    " << std::endl;
     }
+    test_spans();
+    test_thread_exit();
+    test_concurrent();
+    test_size_classes();
+    test_regions();
+    test_nodes();
+    test_batch();
+    test_refill();
+    test_aligned();
+    test_std_alloc();
+    test_reclaimers();
+    test_malloc_api();
+    test_pooled();
+    test_zeroed();
+    test_two_policies();
+    test_trace_size();
+    test_single_thread_exit();
+    test_arena();
+#ifdef __ALLOC_HAS_PMR
+    test_pmr();
+#endif
+    test_trim();
+    test_remote_free();
+#ifdef __ALLOC_HAS_RSEQ
+    test_cpu_drain();
+    test_rseq_fallback(argv[0]);
+#endif
+    test_stats();
+    test_trim_interleaved();
+    test_trim_reuse();
+    test_trim_mixed();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,312 @@
+//  多线程扩展性测试：在1..N个线程下用几种负载跑二级配置器，以std::allocator为基准
+//  用法：bench [最大线程数] [每线程操作数]
+//  same-thread   每个线程自己分配自己释放，保持一个固定大小的活跃对象窗口
+//  producer/consumer   线程两两一组，一个只分配、一个只释放，对象全部跨线程释放
+//  burst         每个线程一次分配一大批对象，再全部释放
+//  mixed         大小按小对象为主、夹带中等对象的分布随机选取
+//  吞吐量按所有线程的总操作数除以墙钟时间计算：从所有线程一起开始到最后一个线程结束；
+//  延迟每16次操作单独计时一次
+//  每次运行之后检查负载分配的对象是否全部释放，没有的话退出码为1，用很小的操作数运行可以当作冒烟测试
+
+//  与list、vector使用同一份配置器头文件，不另外复制
+#include "../list/alloc.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct pool_backend
+{
+    static const char* name() { return "pool"; }
+    static void* allocate(size_t __n) { return __default_alloc_template::allocate(__n); }
+    static void deallocate(void* __p, size_t __n) { __default_alloc_template::deallocate(__p, __n); }
+    //  分配次数减去释放次数
+    static long long live()
+    {
+        __default_alloc_template::pool_stats __s = __default_alloc_template::stats();
+        long long __live = 0;
+        for (size_t __i = 0; __i < sizeof(__s.classes) / sizeof(__s.classes[0]); __i++)
+        {
+            __live += (long long)__s.classes[__i].allocations - (long long)__s.classes[__i].frees;
+        }
+        return __live;
+    }
+};
+
+struct std_backend
+{
+    static const char* name() { return "std::allocator"; }
+    static void* allocate(size_t __n) { return std::allocator<char>().allocate(__n); }
+    static void deallocate(void* __p, size_t __n) { std::allocator<char>().deallocate((char*)__p, __n); }
+    static long long live() { return 0; }
+};
+
+enum { SAMPLE_EVERY = 16, WINDOW = 256, BURST = 4096, RING = 1024 };
+
+//  每个线程的结果
+struct thread_result
+{
+    size_t ops;
+    std::vector<uint32_t> samples;
+};
+
+//  线程自己的伪随机数，避免共享状态
+struct xorshift
+{
+    uint64_t _M_s;
+    explicit xorshift(uint64_t __seed) : _M_s(__seed * 0x9e3779b97f4a7c15ull + 1) {}
+    uint32_t next()
+    {
+        _M_s ^= _M_s << 13;
+        _M_s ^= _M_s >> 7;
+        _M_s ^= _M_s << 17;
+        return (uint32_t)_M_s;
+    }
+};
+
+//  mixed负载的大小分布：7/8落在128字节以内，其余在129..32768之间
+static size_t mixed_size(xorshift& __rng)
+{
+    uint32_t __r = __rng.next();
+    if ((__r & 7) != 0)
+    {
+        return 8 + (__r >> 8) % 121;
+    }
+    return 129 + (__r >> 8) % (32768 - 128);
+}
+
+//  所有线程就绪之后一起开始，最后一个到达的线程记下开始的时间
+struct start_gate
+{
+    std::atomic<int> _M_ready;
+    int _M_total;
+    bench_clock::time_point _M_open;
+    explicit start_gate(int __n) : _M_ready(0), _M_total(__n) {}
+    void wait()
+    {
+        if (_M_ready.fetch_add(1) + 1 == _M_total)
+        {
+            _M_open = bench_clock::now();
+        }
+        while (_M_ready.load() < _M_total)
+        {
+            std::this_thread::yield();
+        }
+    }
+};
+
+//  对一次分配或释放计时，每SAMPLE_EVERY次采样一次
+template <class F>
+static inline void timed(size_t __i, thread_result& __res, F __f)
+{
+    if (__i % SAMPLE_EVERY != 0)
+    {
+        __f();
+        return;
+    }
+    auto __t0 = bench_clock::now();
+    __f();
+    auto __t1 = bench_clock::now();
+    __res.samples.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(__t1 - __t0).count());
+}
+
+template <class Backend>
+static void same_thread(int __id, size_t __ops, bool __mixed, start_gate& __gate, thread_result& __res)
+{
+    xorshift __rng(__id + 1);
+    void* __ptr[WINDOW];
+    size_t __size[WINDOW];
+    for (int __i = 0; __i < WINDOW; __i++)
+    {
+        __size[__i] = __mixed ? mixed_size(__rng) : 32;
+        __ptr[__i] = Backend::allocate(__size[__i]);
+    }
+    __gate.wait();
+    //  每一步释放窗口里的一个对象，再分配一个新的放回去，算两次操作
+    //  按步采样，采到的一步里释放和分配各记一次
+    for (size_t __i = 0; __i < __ops / 2; __i++)
+    {
+        size_t __k = __rng.next() % WINDOW;
+        timed(__i, __res, [&] { Backend::deallocate(__ptr[__k], __size[__k]); });
+        __size[__k] = __mixed ? mixed_size(__rng) : 32;
+        timed(__i, __res, [&] { __ptr[__k] = Backend::allocate(__size[__k]); });
+    }
+    __res.ops = __ops / 2 * 2;
+    for (int __i = 0; __i < WINDOW; __i++)
+    {
+        Backend::deallocate(__ptr[__i], __size[__i]);
+    }
+}
+
+template <class Backend>
+static void burst(int __id, size_t __ops, bool, start_gate& __gate, thread_result& __res)
+{
+    (void)__id;
+    std::vector<void*> __ptr(BURST);
+    __gate.wait();
+    size_t __i = 0;
+    while (__i + 2 * BURST <= __ops)
+    {
+        for (int __k = 0; __k < BURST; __k++, __i++)
+        {
+            timed(__i, __res, [&] { __ptr[__k] = Backend::allocate(48); });
+        }
+        for (int __k = 0; __k < BURST; __k++, __i++)
+        {
+            timed(__i, __res, [&] { Backend::deallocate(__ptr[__k], 48); });
+        }
+    }
+    __res.ops = __i;
+}
+
+//  单生产者单消费者的环形队列
+struct ring
+{
+    void* _M_slot[RING];
+    alignas(64) std::atomic<size_t> _M_head;
+    alignas(64) std::atomic<size_t> _M_tail;
+    ring() : _M_head(0), _M_tail(0) {}
+};
+
+//  偶数编号的线程生产，奇数编号的线程消费，同一对共用一个队列
+template <class Backend>
+static void producer_consumer(int __id, size_t __ops, ring& __q, start_gate& __gate, thread_result& __res)
+{
+    size_t __n = __ops / 2;
+    __gate.wait();
+    if (__id % 2 == 0)
+    {
+        for (size_t __i = 0; __i < __n; __i++)
+        {
+            size_t __tail = __q._M_tail.load(std::memory_order_relaxed);
+            while (__tail - __q._M_head.load(std::memory_order_acquire) == RING)
+            {
+                std::this_thread::yield();
+            }
+            void* __p;
+            timed(__i, __res, [&] { __p = Backend::allocate(64); });
+            __q._M_slot[__tail % RING] = __p;
+            __q._M_tail.store(__tail + 1, std::memory_order_release);
+        }
+    }
+    else
+    {
+        for (size_t __i = 0; __i < __n; __i++)
+        {
+            size_t __head = __q._M_head.load(std::memory_order_relaxed);
+            while (__q._M_tail.load(std::memory_order_acquire) == __head)
+            {
+                std::this_thread::yield();
+            }
+            void* __p = __q._M_slot[__head % RING];
+            __q._M_head.store(__head + 1, std::memory_order_release);
+            timed(__i, __res, [&] { Backend::deallocate(__p, 64); });
+        }
+    }
+    __res.ops = __n;
+}
+
+enum pattern { SAME_THREAD, PRODUCER_CONSUMER, BURST_RELEASE, MIXED };
+
+static const char* pattern_name(pattern __p)
+{
+    switch (__p)
+    {
+    case SAME_THREAD: return "same-thread";
+    case PRODUCER_CONSUMER: return "producer/consumer";
+    case BURST_RELEASE: return "burst";
+    default: return "mixed";
+    }
+}
+
+//  运行一种负载，返回它分配的对象是否全部释放
+template <class Backend>
+static bool run(pattern __p, int __threads, size_t __ops)
+{
+    long long __live = Backend::live();
+    std::vector<thread_result> __res(__threads);
+    std::vector<ring> __rings(__threads / 2 + 1);
+    start_gate __gate(__threads);
+    std::vector<std::thread> __workers;
+    for (int __i = 0; __i < __threads; __i++)
+    {
+        __res[__i].samples.reserve(__ops / SAMPLE_EVERY + 1);
+        __workers.emplace_back([&, __i] {
+            switch (__p)
+            {
+            case SAME_THREAD: same_thread<Backend>(__i, __ops, false, __gate, __res[__i]); break;
+            case MIXED: same_thread<Backend>(__i, __ops, true, __gate, __res[__i]); break;
+            case BURST_RELEASE: burst<Backend>(__i, __ops, false, __gate, __res[__i]); break;
+            case PRODUCER_CONSUMER: producer_consumer<Backend>(__i, __ops, __rings[__i / 2], __gate, __res[__i]); break;
+            }
+        });
+    }
+    for (std::thread& __t : __workers)
+    {
+        __t.join();
+    }
+    //  线程各自计时的话，在CPU不够时先后运行的线程会被当成并行运行，这里只用一段墙钟时间
+    double __seconds = std::chrono::duration<double>(bench_clock::now() - __gate._M_open).count();
+
+    size_t __total = 0;
+    std::vector<uint32_t> __samples;
+    for (thread_result& __r : __res)
+    {
+        __total += __r.ops;
+        __samples.insert(__samples.end(), __r.samples.begin(), __r.samples.end());
+    }
+    std::sort(__samples.begin(), __samples.end());
+    auto __pct = [&](double __q) -> uint32_t
+    {
+        return __samples.empty() ? 0 : __samples[std::min(__samples.size() - 1, (size_t)(__q * __samples.size()))];
+    };
+    printf("%-18s %-15s %7d %10.2f %8u %8u %8u\n", pattern_name(__p), Backend::name(), __threads,
+           __total / __seconds / 1e6, __pct(0.50), __pct(0.99), __pct(0.999));
+    fflush(stdout);
+    if (Backend::live() != __live)
+    {
+        fprintf(stderr, "%s/%s: %lld objects not freed\n", pattern_name(__p), Backend::name(),
+                Backend::live() - __live);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int __max_threads = argc > 1 ? atoi(argv[1]) : (int)std::max(2u, std::thread::hardware_concurrency());
+    size_t __ops = argc > 2 ? (size_t)atoll(argv[2]) : 1000000;
+    if (__max_threads < 1 || __ops < 2 * BURST)
+    {
+        fprintf(stderr, "usage: %s [max threads] [ops per thread >= %d]\n", argv[0], 2 * BURST);
+        return 1;
+    }
+
+    printf("%-18s %-15s %7s %10s %8s %8s %8s\n", "pattern", "allocator", "threads", "Mops/s", "p50(ns)", "p99(ns)", "p999(ns)");
+    const pattern __patterns[] = { SAME_THREAD, PRODUCER_CONSUMER, BURST_RELEASE, MIXED };
+    bool __ok = true;
+    for (pattern __p : __patterns)
+    {
+        int __last = 0;
+        for (int __t = 1; __t <= __max_threads; __t = __t < __max_threads && __t * 2 > __max_threads ? __max_threads : __t * 2)
+        {
+            //  生产者/消费者至少要一对线程，线程数取偶数
+            int __n = __p == PRODUCER_CONSUMER ? std::max(2, __t & ~1) : __t;
+            if (__n == __last)
+            {
+                continue;
+            }
+            __last = __n;
+            __ok = run<pool_backend>(__p, __n, __ops) && __ok;
+            __ok = run<std_backend>(__p, __n, __ops) && __ok;
+        }
+    }
+    return __ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+//  重放__alloc_trace记录下来的分配序列，比较二级配置器、std::allocator和malloc
+//  用法：replay <trace文件> [--touch]
+//  记录按时间戳排序后在一个线程里顺序重放；每种配置器在单独fork出来的子进程里跑，
+//  互不影响，峰值RSS取子进程重放期间的VmHWM减去开始时的VmRSS
+//  --touch：每次分配后把对象的每一页都写一遍，RSS才能反映配置器真正占用的物理内存
+
+//  与list、vector使用同一份配置器头文件，不另外复制
+#include "../list/alloc.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+//  预处理之后的一次操作，对象用槽位编号表示，重放时直接按下标找到指针
+struct replay_op
+{
+    uint8_t op;
+    uint32_t size;
+    uint32_t old_size;
+    uint32_t slot;
+};
+
+struct replay_result
+{
+    double seconds;
+    long peak_kb;
+};
+
+struct pool_backend
+{
+    static const char* name() { return "__default_alloc_template"; }
+    static void* allocate(size_t __n) { return __default_alloc_template::allocate(__n); }
+    static void deallocate(void* __p, size_t __n) { __default_alloc_template::deallocate(__p, __n); }
+    static void* reallocate(void* __p, size_t __old, size_t __new)
+    {
+        return __default_alloc_template::reallocate(__p, __old, __new);
+    }
+};
+
+struct std_backend
+{
+    static const char* name() { return "std::allocator"; }
+    static void* allocate(size_t __n) { return std::allocator<char>().allocate(__n); }
+    static void deallocate(void* __p, size_t __n) { std::allocator<char>().deallocate((char*)__p, __n); }
+    static void* reallocate(void* __p, size_t __old, size_t __new)
+    {
+        void* __q = allocate(__new);
+        memcpy(__q, __p, __old < __new ? __old : __new);
+        deallocate(__p, __old);
+        return __q;
+    }
+};
+
+struct malloc_backend
+{
+    static const char* name() { return "malloc"; }
+    static void* allocate(size_t __n) { return malloc(__n); }
+    static void deallocate(void* __p, size_t) { free(__p); }
+    static void* reallocate(void* __p, size_t, size_t __new) { return realloc(__p, __new); }
+};
+
+//  从/proc/self/status里读一项，单位KB
+static long proc_status_kb(const char* __key)
+{
+    FILE* __f = fopen("/proc/self/status", "r");
+    if (__f == 0)
+    {
+        return 0;
+    }
+    char __line[256];
+    long __kb = 0;
+    size_t __len = strlen(__key);
+    while (fgets(__line, sizeof(__line), __f) != 0)
+    {
+        if (strncmp(__line, __key, __len) == 0)
+        {
+            __kb = atol(__line + __len);
+            break;
+        }
+    }
+    fclose(__f);
+    return __kb;
+}
+
+static void touch(void* __p, size_t __n)
+{
+    for (size_t __i = 0; __i < __n; __i += 4096)
+    {
+        ((volatile char*)__p)[__i] = 1;
+    }
+}
+
+template <class Backend>
+static replay_result run(const std::vector<replay_op>& __ops, size_t __nslots, bool __touch)
+{
+    std::vector<void*> __slots(__nslots, (void*)0);
+    std::vector<uint32_t> __sizes(__nslots, 0);
+    replay_result __r;
+    long __base_kb = proc_status_kb("VmRSS:");
+
+    auto __begin = std::chrono::steady_clock::now();
+    for (const replay_op& __o : __ops)
+    {
+        switch (__o.op)
+        {
+        case __alloc_trace::op_allocate:
+            __slots[__o.slot] = Backend::allocate(__o.size);
+            if (__touch)
+            {
+                touch(__slots[__o.slot], __o.size);
+            }
+            break;
+        case __alloc_trace::op_deallocate:
+            Backend::deallocate(__slots[__o.slot], __o.size);
+            __slots[__o.slot] = 0;
+            break;
+        case __alloc_trace::op_reallocate:
+            __slots[__o.slot] = Backend::reallocate(__slots[__o.slot], __o.old_size, __o.size);
+            if (__touch)
+            {
+                touch(__slots[__o.slot], __o.size);
+            }
+            break;
+        }
+        __sizes[__o.slot] = __o.size;
+    }
+    auto __end = std::chrono::steady_clock::now();
+    __r.seconds = std::chrono::duration<double>(__end - __begin).count();
+    __r.peak_kb = proc_status_kb("VmHWM:") - __base_kb;
+
+    //  记录结束时还活着的对象，不计入时间
+    for (size_t __i = 0; __i < __nslots; __i++)
+    {
+        if (__slots[__i] != 0)
+        {
+            Backend::deallocate(__slots[__i], __sizes[__i]);
+        }
+    }
+    return __r;
+}
+
+//  在子进程里重放，结果通过管道传回来
+template <class Backend>
+static void run_in_child(const std::vector<replay_op>& __ops, size_t __nslots, bool __touch)
+{
+    int __fds[2];
+    if (pipe(__fds) != 0)
+    {
+        perror("pipe");
+        return;
+    }
+    pid_t __pid = fork();
+    if (__pid == 0)
+    {
+        close(__fds[0]);
+        replay_result __r = run<Backend>(__ops, __nslots, __touch);
+        ssize_t __n = write(__fds[1], &__r, sizeof(__r));
+        _exit(__n == (ssize_t)sizeof(__r) ? 0 : 1);
+    }
+    close(__fds[1]);
+    replay_result __r;
+    ssize_t __n = read(__fds[0], &__r, sizeof(__r));
+    close(__fds[0]);
+    int __status;
+    waitpid(__pid, &__status, 0);
+    if (__n != (ssize_t)sizeof(__r))
+    {
+        printf("%-26s failed\n", Backend::name());
+        return;
+    }
+    printf("%-26s %10.3f %12.2f %12.1f\n", Backend::name(), __r.seconds * 1000,
+           __ops.size() / __r.seconds / 1e6, __r.peak_kb / 1024.0);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <trace> [--touch]\n", argv[0]);
+        return 1;
+    }
+    bool __touch = argc > 2 && strcmp(argv[2], "--touch") == 0;
+
+    FILE* __f = fopen(argv[1], "rb");
+    if (__f == 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    __alloc_trace::file_header __h;
+    if (fread(&__h, sizeof(__h), 1, __f) != 1 || memcmp(__h.magic, "ALLOCTRC", 8) != 0
+        || __h.record_size != sizeof(__alloc_trace::record))
+    {
+        fprintf(stderr, "%s: not an allocation trace\n", argv[1]);
+        fclose(__f);
+        return 1;
+    }
+    std::vector<__alloc_trace::record> __records;
+    __alloc_trace::record __rec;
+    while (fread(&__rec, sizeof(__rec), 1, __f) == 1)
+    {
+        __records.push_back(__rec);
+    }
+    fclose(__f);
+
+    //  每个线程的记录各自有序，文件里是按缓冲区写出的顺序交错的
+    std::stable_sort(__records.begin(), __records.end(),
+        [](const __alloc_trace::record& __a, const __alloc_trace::record& __b)
+        { return __a.timestamp < __b.timestamp; });
+
+    //  把地址换成槽位编号；开始记录之前分配的对象找不到对应的分配，它们的释放直接跳过
+    std::vector<replay_op> __ops;
+    std::vector<uint32_t> __slot_size;
+    std::unordered_map<uint64_t, uint32_t> __live;
+    size_t __skipped = 0;
+    int __threads = 0;
+    __ops.reserve(__records.size());
+    for (const __alloc_trace::record& __r : __records)
+    {
+        __threads = std::max(__threads, (int)__r.thread + 1);
+        replay_op __o;
+        __o.op = __r.op;
+        __o.size = __r.size;
+        __o.old_size = 0;
+        if (__r.op == __alloc_trace::op_allocate)
+        {
+            __o.slot = (uint32_t)__slot_size.size();
+            __slot_size.push_back(__r.size);
+            __live[__r.id] = __o.slot;
+        }
+        else
+        {
+            uint64_t __key = __r.op == __alloc_trace::op_deallocate ? __r.id : __r.old_id;
+            auto __it = __live.find(__key);
+            if (__it == __live.end())
+            {
+                __skipped++;
+                continue;
+            }
+            __o.slot = __it->second;
+            __live.erase(__it);
+            if (__r.op == __alloc_trace::op_reallocate)
+            {
+                __o.old_size = __slot_size[__o.slot];
+                __slot_size[__o.slot] = __r.size;
+                __live[__r.id] = __o.slot;
+            }
+        }
+        __ops.push_back(__o);
+    }
+
+    printf("%zu records from %d threads, %zu replayed, %zu skipped, %zu live at end\n",
+           __records.size(), __threads, __ops.size(), __skipped, __live.size());
+    printf("%-26s %10s %12s %12s\n", "allocator", "time(ms)", "Mops/s", "peak RSS(MB)");
+    fflush(stdout);
+    run_in_child<pool_backend>(__ops, __slot_size.size(), __touch);
+    run_in_child<std_backend>(__ops, __slot_size.size(), __touch);
+    run_in_child<malloc_backend>(__ops, __slot_size.size(), __touch);
+    return 0;
+}
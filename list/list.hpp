@@ -148,6 +148,59 @@ protected:
         return p;
     }
 
+    //  批量插入时每次向配置器申请的节点个数
+    enum { __BATCH = 128 };
+
+    //  insert(position, n, x)用的值来源，每次解引用都得到同一个x
+    struct __fill_source
+    {
+        const T& x;
+        const T& operator*() const { return x; }
+        __fill_source& operator++() { return *this; }
+    };
+
+    //  在position之前插入n个节点，值依次取自*first
+    //  节点每__BATCH个用一次allocate_batch申请，全部构造完成后再整段接入链表
+    template <class Source>
+    void batch_insert(iterator position, size_type n, Source first)
+    {
+        link_type nodes[__BATCH];
+        while (n > 0)
+        {
+            size_type k = n < (size_type)__BATCH ? n : (size_type)__BATCH;
+            list_node_allocator::allocate_batch(nodes, k);
+            size_type built = 0;
+            try
+            {
+                for (; built < k; ++built, ++first)
+                {
+                    construct(&nodes[built]->data, *first);
+                }
+            }
+            catch(...)
+            {
+                for (size_type i = 0; i < built; i++)
+                {
+                    destroy(&nodes[i]->data);
+                }
+                list_node_allocator::deallocate_batch(nodes, k);
+                throw;
+            }
+
+            //  把这一段节点串起来, 接到position之前
+            link_type prev = link_type(position._node->prev);
+            for (size_type i = 0; i < k; i++)
+            {
+                nodes[i]->prev = prev;
+                prev->next = nodes[i];
+                prev = nodes[i];
+            }
+            prev->next = position._node;
+            position._node->prev = prev;
+            n -= k;
+        }
+    }
+
     //  调用析构并释放一个元素大小的空间
     void destroy_node(link_type p)
     {
@@ -178,26 +231,25 @@ protected:
         }
     }
 
-    //  接受一个迭代器范围 [first, last)，并将范围内的元素逐个添加到 list 中
+    //  接受一个迭代器范围 [first, last)，并将范围内的元素添加到 list 中
+    //  先数出元素个数，节点再批量申请
     void range_initialize(iterator first, iterator last)
     {
-        empty_initialize();
-        while (first != last)
-        {
-            //  后面会实现
-            push_back(*first);
-            ++first;
-        }
+        range_initialize(const_iterator(first), const_iterator(last));
     }
 
     void range_initialize(const_iterator first, const_iterator last)
     {
         empty_initialize();
-        while (first != last)
+        try
         {
-            //  后面会实现
-            push_back(*first);
-            ++first;
+            insert(end(), first, last);
+        }
+        catch(...)
+        {
+            clear();
+            put_node(node);
+            throw;
         }
     }
 
@@ -482,17 +534,16 @@ public:
     }
     void insert(iterator position, const_iterator first, const_iterator last)
     {
-        for(; first != last; ++first)
+        size_type n = 0;
+        for (const_iterator it = first; it != last; ++it)
         {
-            insert(position, *first);
+            ++n;
         }
+        batch_insert(position, n, first);
     }
     void insert(iterator position, size_type n, const T& x)
     {
-        for(; n > 0; --n)
-        {
-            insert(position, x);
-        }
+        batch_insert(position, n, __fill_source{x});
     }
 
 public:
@@ -3,9 +3,84 @@
 #include <iostream>
 
 #include <list>
+#include <cassert>
+
+//  单线程配置器：结点都从本线程的自由链表分配，删除的结点马上被下一次插入复用，
+//  反复插入删除同样多的元素不会再向内存池要内存
+static void test_single_thread()
+{
+	list<int, __single_thread_alloc> ls;
+	for (int i = 0; i < 1000; i++)
+	{
+		ls.push_back(i);
+	}
+	int* last = &ls.back();
+	ls.pop_back();
+	ls.push_back(999);
+	assert(&ls.back() == last);
+
+	size_t heap = __single_thread_alloc::heap_size();
+	assert(heap > 0);
+	for (int round = 0; round < 10; round++)
+	{
+		ls.clear();
+		for (int i = 0; i < 1000; i++)
+		{
+			ls.push_front(i);
+		}
+	}
+	assert(__single_thread_alloc::heap_size() == heap);
+	assert(ls.size() == 1000 && ls.front() == 999 && ls.back() == 0);
+
+	list<int, __single_thread_alloc> copy(ls);
+	assert(copy.size() == 1000 && copy.front() == 999);
+	std::cout << "single thread: ok" << std::endl;
+}
+
+//  非默认的大小类表：16字节间隔到256，之后每个2的幂区间8份，最大16KB
+typedef __size_classes<16, 256, 8, 16384> fine_classes;
+typedef __basic_default_alloc<fine_classes> fine_alloc;
+
+static_assert(fine_classes::classes == 64, "16 small classes + 6 ranges * 8 steps");
+static_assert(fine_classes::index(1) == 0 && fine_classes::size(0) == 16, "first class");
+static_assert(fine_classes::index(256) == 15 && fine_classes::index(257) == 16, "small/medium boundary");
+static_assert(fine_classes::size(16) == 288 && fine_classes::size(23) == 512, "first medium range");
+static_assert(fine_classes::index(16384) == 63 && fine_classes::size(63) == 16384, "last class");
+
+//  大小类表不同时list照样工作，每个对象都落在新表中能放下它的最小大小类中
+static void test_size_classes()
+{
+	struct item
+	{
+		char data[300];
+	};
+	list<item, fine_alloc> ls;
+	for (int i = 0; i < 1000; i++)
+	{
+		ls.push_back(item());
+		ls.back().data[0] = (char)i;
+	}
+	int i = 0;
+	for (auto& it : ls)
+	{
+		assert(it.data[0] == (char)i++);
+	}
+
+	const size_t sizes[] = { 1, 17, 256, 300, 1000, 16384 };
+	for (size_t n : sizes)
+	{
+		void* p = fine_alloc::allocate(n);
+		assert(fine_alloc::usable_size(p) == fine_classes::size(fine_classes::index(n)));
+		assert(fine_alloc::usable_size(p) - n < n / 8 + 16);
+		fine_alloc::deallocate(p, n);
+	}
+	std::cout << "size classes: ok" << std::endl;
+}
 
 int main()
 {
+	test_single_thread();
+	test_size_classes();
     list<int>ls;
     list<int> List;
 	List.push_back(1);
@@ -0,0 +1,407 @@
+//  用二级配置器替换进程的malloc/free/new/delete，不需要重新编译就能在现有程序上评估内存池
+//  编译：g++ -std=gnu++14 -O2 -fPIC -shared -pthread preload.cc -o libpool.so -ldl
+//  使用：LD_PRELOAD=./libpool.so <程序>
+//  线程很多的程序可以加上-DALLOC_PERCPU_CACHE，缓存按CPU而不是按线程分配
+//
+//  不超过max_bytes的请求由__default_alloc_template分配，更大的直接交给glibc的__libc_malloc等函数：
+//  一级配置器内部调用的malloc会被这里替换掉，再经过它只会绕回到这个文件
+//  释放时由page map判断对象是否在内存池中，不在的一律交给__libc_free，
+//  所以没有替换的valloc/pvalloc等函数分配的内存也能正确释放
+
+//  与list、vector使用同一份配置器头文件，不另外复制
+#include "../list/alloc.hpp"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <new>
+
+extern "C"
+{
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void* __libc_memalign(size_t, size_t);
+    void __libc_free(void*);
+}
+
+typedef __default_alloc_template __pool;
+
+//  malloc返回的内存要满足max_align_t的对齐，x86-64上是16字节
+enum { __MALLOC_ALIGN = 16 };
+
+//  glibc的malloc_usable_size，只用于不在内存池中的指针
+typedef size_t (*__usable_size_func)(void*);
+static __usable_size_func __real_usable_size = 0;
+
+static size_t __libc_usable_size(void* __p)
+{
+    __usable_size_func __f = __atomic_load_n(&__real_usable_size, __ATOMIC_ACQUIRE);
+    if (__f == 0)
+    {
+        __f = (__usable_size_func)dlsym(RTLD_NEXT, "malloc_usable_size");
+        __atomic_store_n(&__real_usable_size, __f, __ATOMIC_RELEASE);
+    }
+    return __f(__p);
+}
+
+static bool __pooled(const void* __p)
+{
+    return __region_alloc::node_of(__p) >= 0;
+}
+
+//  失败时返回0并设置errno，不抛出异常
+static void* __pool_malloc(size_t __n)
+{
+    if (__n > (size_t)__pool::max_bytes)
+    {
+        return __libc_malloc(__n);
+    }
+    //  不到16字节的请求也按16字节对齐：malloc(1)同样可能用来存放long double或SSE数据
+    try
+    {
+        return __pool::allocate_aligned(__n == 0 ? 1 : __n, __MALLOC_ALIGN);
+    }
+    catch (const std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+}
+
+//  __align是2的幂；内存池最多支持64字节对齐，更大的对齐交给glibc
+static void* __pool_memalign(size_t __align, size_t __n)
+{
+    if (__align <= (size_t)__MALLOC_ALIGN)
+    {
+        return __pool_malloc(__n);
+    }
+    if (__align > 64 || __n > (size_t)__pool::max_bytes)
+    {
+        return __libc_memalign(__align, __n);
+    }
+    try
+    {
+        return __pool::allocate_aligned(__n == 0 ? 1 : __n, __align);
+    }
+    catch (const std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+}
+
+static void __pool_free(void* __p)
+{
+    if (__p == 0)
+    {
+        return;
+    }
+    if (__pooled(__p))
+    {
+        __pool::free(__p);
+    }
+    else
+    {
+        __libc_free(__p);
+    }
+}
+
+static void* __pool_realloc(void* __p, size_t __n)
+{
+    if (__p == 0)
+    {
+        return __pool_malloc(__n);
+    }
+    if (__n == 0)
+    {
+        __pool_free(__p);
+        return 0;
+    }
+    size_t __old_sz;
+    if (__pooled(__p))
+    {
+        //  新的大小还在对象所在的大小类中，并且没有缩小到一半以下时原地返回
+        __old_sz = __pool::usable_size(__p);
+        if (__n <= __old_sz && __n > __old_sz / 2)
+        {
+            return __p;
+        }
+    }
+    else if (__n > (size_t)__pool::max_bytes)
+    {
+        return __libc_realloc(__p, __n);
+    }
+    else
+    {
+        __old_sz = __libc_usable_size(__p);
+    }
+    void* __result = __pool_malloc(__n);
+    if (__result == 0)
+    {
+        return 0;
+    }
+    std::memcpy(__result, __p, std::min(__old_sz, __n));
+    __pool_free(__p);
+    return __result;
+}
+
+//  operator new的语义：失败时调用new_handler，没有设置时抛出bad_alloc
+static void* __pool_new(size_t __n, size_t __align)
+{
+    for (;;)
+    {
+        void* __p = __pool_memalign(__align, __n);
+        if (__p != 0)
+        {
+            return __p;
+        }
+        std::new_handler __handler = std::get_new_handler();
+        if (__handler == 0)
+        {
+            throw std::bad_alloc();
+        }
+        __handler();
+    }
+}
+
+//  fork时其他线程可能正持有配置器的锁，子进程中没有线程会释放它们
+//  除了内存池本身，__monotonic_arena的空闲block栈也在这里加锁
+static void __fork_lock()
+{
+    __pool::lock_all();
+    __monotonic_arena::lock();
+}
+
+static void __fork_unlock()
+{
+    __monotonic_arena::unlock();
+    __pool::unlock_all();
+}
+
+__attribute__((constructor)) static void __pool_init()
+{
+    pthread_atfork(__fork_lock, __fork_unlock, __fork_unlock);
+}
+
+extern "C"
+{
+
+void* malloc(size_t __n) noexcept
+{
+    return __pool_malloc(__n);
+}
+
+void free(void* __p) noexcept
+{
+    __pool_free(__p);
+}
+
+void* calloc(size_t __count, size_t __size) noexcept
+{
+    size_t __n;
+    if (__builtin_mul_overflow(__count, __size, &__n))
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+    if (__n > (size_t)__pool::max_bytes)
+    {
+        return __libc_calloc(__count, __size);
+    }
+    //  大小向上取到16的倍数，得到的大小类和allocate_aligned(__n, 16)相同，自然对齐至少16字节；
+    //  对象从刚映射、还没有写过的内存中切出时不需要再清零
+    __n = __n == 0 ? (size_t)__MALLOC_ALIGN : (__n + __MALLOC_ALIGN - 1) & ~(size_t)(__MALLOC_ALIGN - 1);
+    try
+    {
+        return __pool::allocate_zeroed(__n);
+    }
+    catch (const std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+}
+
+void* realloc(void* __p, size_t __n) noexcept
+{
+    return __pool_realloc(__p, __n);
+}
+
+int posix_memalign(void** __result, size_t __align, size_t __n) noexcept
+{
+    if (__align < sizeof(void*) || (__align & (__align - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    void* __p = __pool_memalign(__align, __n);
+    if (__p == 0)
+    {
+        return ENOMEM;
+    }
+    *__result = __p;
+    return 0;
+}
+
+void* aligned_alloc(size_t __align, size_t __n) noexcept
+{
+    if (__align == 0 || (__align & (__align - 1)) != 0)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return __pool_memalign(__align, __n);
+}
+
+void* memalign(size_t __align, size_t __n) noexcept
+{
+    if (__align == 0 || (__align & (__align - 1)) != 0)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return __pool_memalign(__align, __n);
+}
+
+size_t malloc_usable_size(void* __p) noexcept
+{
+    if (__p == 0)
+    {
+        return 0;
+    }
+    return __pooled(__p) ? __pool::usable_size(__p) : __libc_usable_size(__p);
+}
+
+}
+
+void* operator new(size_t __n)
+{
+    return __pool_new(__n, __MALLOC_ALIGN);
+}
+
+void* operator new[](size_t __n)
+{
+    return __pool_new(__n, __MALLOC_ALIGN);
+}
+
+void* operator new(size_t __n, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return __pool_new(__n, __MALLOC_ALIGN);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return 0;
+    }
+}
+
+void* operator new[](size_t __n, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return __pool_new(__n, __MALLOC_ALIGN);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return 0;
+    }
+}
+
+void operator delete(void* __p) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete[](void* __p) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete(void* __p, const std::nothrow_t&) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete[](void* __p, const std::nothrow_t&) noexcept
+{
+    __pool_free(__p);
+}
+
+//  带大小的delete：大小类由page map给出，不需要用传入的大小
+void operator delete(void* __p, size_t) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete[](void* __p, size_t) noexcept
+{
+    __pool_free(__p);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t __n, std::align_val_t __align)
+{
+    return __pool_new(__n, (size_t)__align);
+}
+
+void* operator new[](size_t __n, std::align_val_t __align)
+{
+    return __pool_new(__n, (size_t)__align);
+}
+
+void* operator new(size_t __n, std::align_val_t __align, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return __pool_new(__n, (size_t)__align);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return 0;
+    }
+}
+
+void* operator new[](size_t __n, std::align_val_t __align, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return __pool_new(__n, (size_t)__align);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return 0;
+    }
+}
+
+void operator delete(void* __p, std::align_val_t) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete[](void* __p, std::align_val_t) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete(void* __p, size_t, std::align_val_t) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete[](void* __p, size_t, std::align_val_t) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete(void* __p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    __pool_free(__p);
+}
+
+void operator delete[](void* __p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    __pool_free(__p);
+}
+#endif
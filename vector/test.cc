@@ -2,9 +2,41 @@
 
 #include <iostream>
 #include <string>
+#include <cassert>
+
+//  单线程配置器：扩容时旧的空间还回本线程的自由链表，
+//  同样的增长过程再来一遍用的都是这些空间，不会再向内存池要内存
+static void test_single_thread()
+{
+	size_t heap = 0;
+	for (int round = 0; round < 10; round++)
+	{
+		vector<int, __single_thread_alloc> v;
+		for (int i = 0; i < 1000; i++)
+		{
+			v.push_back(i);
+		}
+		for (int i = 0; i < 1000; i++)
+		{
+			assert(v[i] == i);
+		}
+		if (round == 0)
+		{
+			heap = __single_thread_alloc::heap_size();
+			assert(heap > 0);
+		}
+		assert(__single_thread_alloc::heap_size() == heap);
+	}
+
+	vector<std::string, __single_thread_alloc> st(3, "single");
+	st.push_back("thread");
+	assert(st.size() == 4 && st[0] == "single" && st[3] == "thread");
+	std::cout << "single thread: ok" << std::endl;
+}
 
 int main()
 {
+	test_single_thread();
     vector<int> vec;
     vector<int> v1;
 	vector<int> v2(4);
@@ -38,6 +38,23 @@ public:
         finish = start + n;
         end_of_storage = finish;
     }
+    //  构造n个值初始化的元素
+    //  平凡类型值初始化之后每个字节都是0(数据成员指针除外, 这里不考虑), 直接向配置器申请清零的内存,
+    //  配置器知道哪些内存是刚从系统映射的、本来就是0, 不需要再逐个写一遍
+    void fill_initialize(size_type n)
+    {
+        value_initialize(n, std::is_trivial<T>());
+    }
+    void value_initialize(size_type n, std::true_type)
+    {
+        start = data_allocator::allocate_zeroed(n);
+        finish = start + n;
+        end_of_storage = finish;
+    }
+    void value_initialize(size_type n, std::false_type)
+    {
+        fill_initialize(n, T());
+    }
     //  调用默认的第二配置器分配内存, 分配失败就释放所分配的内存
     iterator allocate_and_fill(size_type n, const T& X)
     {
@@ -61,7 +78,7 @@ public:
     vector() : start(0), finish(0), end_of_storage(0) {}
     //  必须显示的调用这个构造函数, 接受一个值
     //  类似平时使用时：vector<int> vec(5);  -> 构造一个大小为5默认值为0的vector
-    explicit vector(size_type n) { fill_initialize(n, T()); }
+    explicit vector(size_type n) { fill_initialize(n); }
     //  接受一个大小和初始化值. int和long都执行相同的函数初始化
     //  类似平时使用时：vector<int> vec(3, 7); -> 构造一个大小为3值都为7的 vector
     vector(size_type n, const T& value) { fill_initialize(n, value); }